@@ -103,7 +103,8 @@ enum NSVGfillRule {
 };
 
 enum NSVGflags {
-	NSVG_FLAGS_VISIBLE = 0x01
+	NSVG_FLAGS_VISIBLE = 0x01,
+	NSVG_FLAGS_RECT = 0x02		// Single axis aligned rectangle with sharp corners, from a <rect> element.
 };
 
 enum NSVGpaintOrder {
@@ -2463,9 +2464,13 @@ static void nsvg__parseRect(NSVGparser* p, const char** attr)
 	if (ry > h/2.0f) ry = h/2.0f;
 
 	if (w != 0.0f && h != 0.0f) {
+		NSVGattrib* a = nsvg__getAttr(p);
+		NSVGshape* tail = p->shapesTail;
+		int sharp = rx < 0.00001f || ry < 0.0001f;
+
 		nsvg__resetPath(p);
 
-		if (rx < 0.00001f || ry < 0.0001f) {
+		if (sharp) {
 			nsvg__moveTo(p, x, y);
 			nsvg__lineTo(p, x+w, y);
 			nsvg__lineTo(p, x+w, y+h);
@@ -2486,6 +2491,11 @@ static void nsvg__parseRect(NSVGparser* p, const char** attr)
 		nsvg__addPath(p, 1);
 
 		nsvg__addShape(p);
+
+		// Let the rasterizer fill rectangles directly if the transform keeps them axis aligned.
+		if (sharp && p->shapesTail != tail &&
+			((a->xform[1] == 0.0f && a->xform[2] == 0.0f) || (a->xform[0] == 0.0f && a->xform[3] == 0.0f)))
+			p->shapesTail->flags |= NSVG_FLAGS_RECT;
 	}
 }
 
@@ -34,6 +34,8 @@ extern "C" {
 #endif
 
 typedef struct NSVGrasterizer NSVGrasterizer;
+typedef struct NSVGrasterCache NSVGrasterCache;
+typedef struct NSVGrasterizerPool NSVGrasterizerPool;
 
 /* Example Usage:
 	// Load SVG
@@ -51,22 +53,191 @@ typedef struct NSVGrasterizer NSVGrasterizer;
 // Allocated rasterizer context.
 NSVGrasterizer* nsvgCreateRasterizer(void);
 
-// Rasterizes SVG image, returns RGBA image (non-premultiplied alpha)
+// Rasterizes SVG image, returns RGBA image (non-premultiplied alpha, see nsvgRasterizerSetPremultiplied())
+// The image is only read by the render functions, so any number of threads can render the same image
+// at once, each with its own rasterizer context (see nsvgAcquireRasterizer()).
 //   r - pointer to rasterizer context
 //   image - pointer to image to rasterize
 //   tx,ty - image offset (applied after scaling)
 //   scale - image scale
-//   dst - pointer to destination image data, 4 bytes per pixel (RGBA)
+//   dst - pointer to destination image data, 4 bytes per pixel (RGBA, see nsvgRasterizerSetFormat())
 //   w - width of the image to render
 //   h - height of the image to render
 //   stride - number of bytes per scaleline in the destination buffer
 void nsvgRasterize(NSVGrasterizer* r,
-				   NSVGimage* image, float tx, float ty, float scale,
+				   const NSVGimage* image, float tx, float ty, float scale,
 				   unsigned char* dst, int w, int h, int stride);
 
+// Rasterizes SVG image transformed by an affine matrix, returns RGBA image (non-premultiplied alpha)
+//   xform - 2x3 matrix [a b c d e f] which maps a point x,y of the image to the pixel
+//           x*a + y*c + e, x*b + y*d + f, the same layout as NSVGgradient::xform
+// Strokes and gradients are transformed with the shapes, so stroke widths scale with the matrix.
+// Matrices which only scale uniformly and translate are rendered as with nsvgRasterize().
+// Other parameters are the same as for nsvgRasterize().
+void nsvgRasterizeXform(NSVGrasterizer* r,
+						const NSVGimage* image, const float* xform,
+						unsigned char* dst, int w, int h, int stride);
+
+// Rasterizes a rectangular region of SVG image, returns RGBA image (non-premultiplied alpha)
+// The region is a window into the image rendered with tx,ty,scale. Shapes and paths outside
+// the region are skipped before flattening, so the cost scales with the content of the region.
+// The pixels match the full image, except with straight alpha output, where the transparent pixels
+// along the edges of the region are defringed only from the pixels inside it.
+//   x,y - position of the top-left corner of the region in the rendered image
+//   w,h - size of the region
+//   dst - pointer to destination image data of the region, 4 bytes per pixel (RGBA)
+//   stride - number of bytes per scaleline in the destination buffer
+// Other parameters are the same as for nsvgRasterize().
+void nsvgRasterizeRegion(NSVGrasterizer* r,
+						 const NSVGimage* image, float tx, float ty, float scale,
+						 int x, int y, int w, int h,
+						 unsigned char* dst, int stride);
+
+// Rasterizes SVG image using multiple threads, returns RGBA image (non-premultiplied alpha)
+// The destination is split into horizontal bands which are rendered by worker contexts
+// owned by the rasterizer. The output is identical to nsvgRasterize().
+//   nthreads - number of threads to use, values less than 2 render on the calling thread
+// Other parameters are the same as for nsvgRasterize().
+void nsvgRasterizeParallel(NSVGrasterizer* r,
+						   const NSVGimage* image, float tx, float ty, float scale,
+						   unsigned char* dst, int w, int h, int stride, int nthreads);
+
+// Re-renders the parts of an image which changed since it was rendered into dst by nsvgRasterize(),
+// with the same position, scale and rasterizer settings. The changed areas are cleared and only the
+// shapes overlapping them are rendered again, clipped to the areas.
+//   shapes - nshapes changed shapes, the pixels each of them can draw to are re-rendered
+//   rects - nrects rectangles of pixels x0,y0,x1,y1 (x1,y1 exclusive) to re-render, for example the
+//           area of a shape before it was moved or hidden, see nsvgRasterizerShapeRect()
+// Other parameters are the same as for nsvgRasterize().
+// With NSVG_CLEAR_NONE the areas are composited over the pixels in dst, restore the background first.
+void nsvgRasterizeDirty(NSVGrasterizer* r,
+						const NSVGimage* image, float tx, float ty, float scale,
+						NSVGshape** shapes, int nshapes, const int* rects, int nrects,
+						unsigned char* dst, int w, int h, int stride);
+
+// Returns the rectangle of pixels x0,y0,x1,y1 (x1,y1 exclusive) that a shape can draw to when the
+// image is rendered at tx,ty,scale, from the shape's bounds and stroke. Empty if it draws nothing.
+void nsvgRasterizerShapeRect(NSVGrasterizer* r, const NSVGshape* shape, float tx, float ty, float scale, int* rect);
+
+// Allocated cache for the flattened geometry of an image, see nsvgRasterizeCached().
+NSVGrasterCache* nsvgCreateRasterCache(void);
+
+// Rasterizes SVG image like nsvgRasterize(), reusing the fills and strokes flattened by the previous
+// call with the same cache. The geometry is flattened again when the image, the scale or the rasterizer's
+// tessellation settings change, so rendering at a new offset only moves the cached edges.
+// The cache does not notice changes made to the image itself, call nsvgResetRasterCache() after editing it.
+//   cache - pointer to the geometry cache, can be shared by rasterizers but not used by two at once
+// Other parameters are the same as for nsvgRasterize().
+void nsvgRasterizeCached(NSVGrasterizer* r, NSVGrasterCache* cache,
+						 const NSVGimage* image, float tx, float ty, float scale,
+						 unsigned char* dst, int w, int h, int stride);
+
+// Drops the cached geometry, the next render flattens the image again.
+void nsvgResetRasterCache(NSVGrasterCache* cache);
+
+// Deletes geometry cache.
+void nsvgDeleteRasterCache(NSVGrasterCache* cache);
+
+enum NSVGcoverage {
+	NSVG_COVERAGE_SCANLINE = 0,	// Coverage is accumulated into a row as wide as the image (default).
+	NSVG_COVERAGE_CELLS = 1,	// Coverage is stored sparsely at the pixels crossed by edges.
+	NSVG_COVERAGE_ANALYTIC = 2,	// Exact area coverage, computed in one pass per pixel row.
+};
+
+// Selects how the rasterizer accumulates coverage, one of NSVGcoverage.
+// The first two modes sample each pixel row at the sub-scanlines set by nsvgRasterizerSetSubsamples()
+// and produce identical images.
+// The cost of a row with NSVG_COVERAGE_CELLS depends on the number of edge crossings instead
+// of the width spanned by the shape, which is faster for wide images with thin features.
+// NSVG_COVERAGE_ANALYTIC computes the area of each pixel covered by the shape, which gives
+// smoother antialiasing. Where edges of the same shape overlap within a pixel, the coverage is
+// approximated from the accumulated winding.
+void nsvgRasterizerSetCoverage(NSVGrasterizer* r, int coverage);
+
+// Sets the number of sub-scanlines sampled per pixel row, from 1 to 16, the default is 5.
+// Fewer samples render faster with coarser antialiasing of near horizontal edges, 1 only
+// antialiases horizontally. Not used by NSVG_COVERAGE_ANALYTIC.
+void nsvgRasterizerSetSubsamples(NSVGrasterizer* r, int subsamples);
+
+enum NSVGflattening {
+	NSVG_FLATTEN_SUBDIVIDE = 0,	// Curves are split in half recursively until flat (default).
+	NSVG_FLATTEN_UNIFORM = 1,	// Curves are split into evenly spaced segments counted up front.
+};
+
+// Selects how curves are flattened into line segments, one of NSVGflattening.
+// NSVG_FLATTEN_UNIFORM estimates the number of segments needed to stay within the tessellation
+// tolerance from the curve's second differences, and steps along the curve by forward differencing.
+// It usually emits fewer segments than subdividing and avoids the recursion.
+void nsvgRasterizerSetFlattening(NSVGrasterizer* r, int flattening);
+
+// Sets whether the rendered images are left with premultiplied alpha. By default the colors are
+// divided by alpha and the edges of transparent areas are defringed, which takes two passes over
+// the image. With premultiplied output, which is what most compositors blend with, both are skipped.
+void nsvgRasterizerSetPremultiplied(NSVGrasterizer* r, int premultiplied);
+
+enum NSVGformat {
+	NSVG_FORMAT_RGBA8 = 0,	// 4 bytes per pixel in R,G,B,A order (default).
+	NSVG_FORMAT_BGRA8 = 1,	// 4 bytes per pixel in B,G,R,A order.
+	NSVG_FORMAT_RGB565 = 2,	// 2 bytes per pixel, a native endian 16 bit value with red in the top 5 bits.
+	NSVG_FORMAT_A8 = 3,		// 1 byte per pixel, alpha only.
+	NSVG_FORMAT_MASK1 = 4,	// 1 bit per pixel, the most significant bit of a byte is the leftmost pixel.
+};
+
+// Selects the pixel format of the destination images, one of NSVGformat. The stride passed to the
+// render functions is in bytes whatever the format. RGB565 has no alpha, the shapes are composited
+// over black. A bit of MASK1 is set where any shape covers the pixel with at least half opacity.
+// Unpremultiplying only applies to the RGBA and BGRA formats.
+void nsvgRasterizerSetFormat(NSVGrasterizer* r, int format);
+
+enum NSVGclear {
+	NSVG_CLEAR_ALL = 0,		// The whole destination is cleared to transparent before rendering (default).
+	NSVG_CLEAR_BOUNDS = 1,	// Only the area the shapes can reach is cleared, other pixels are left as they are.
+	NSVG_CLEAR_NONE = 2,	// Nothing is cleared, the shapes are composited over the existing pixels.
+};
+
+// Selects how much of the destination is cleared before rendering, one of NSVGclear.
+// Rendering onto existing RGBA or BGRA pixels expects them to be premultiplied, and they stay so with
+// nsvgRasterizerSetPremultiplied(). Otherwise, with NSVG_CLEAR_NONE the whole image is unpremultiplied
+// at the end, and with NSVG_CLEAR_BOUNDS only the cleared area.
+void nsvgRasterizerSetClear(NSVGrasterizer* r, int clear);
+
+// Enables skipping the shapes which are hidden under later shapes. Before rendering, the shapes are
+// walked back to front, and the tiles of the image covered by opaque convex fills, such as rectangles
+// and circles of solid color, are tracked. Shapes which only reach covered tiles are not rendered.
+// The image is the same with and without, it is off by default.
+void nsvgRasterizerSetOcclusion(NSVGrasterizer* r, int enabled);
+
+// Allocates the work buffers needed to render the image at the given scale into images up to
+// 'width' pixels wide, and no taller than the image, with the current settings, so that rendering
+// does not grow them. The image is flattened once to count its edges. For nsvgRasterizeXform()
+// use the largest scale of the matrix.
+// Returns 0 if the memory could not be allocated.
+int nsvgRasterizerReserve(NSVGrasterizer* r, const NSVGimage* image, float scale, int width);
+
+// Frees the work buffers larger than maxBytes, including those of the threads used by
+// nsvgRasterizeParallel(). They are allocated again when needed, 0 frees all of them.
+// Long running renderers can call this between renders to give back the memory that a
+// large image needed.
+void nsvgRasterizerTrim(NSVGrasterizer* r, int maxBytes);
+
 // Deletes rasterizer context.
 void nsvgDeleteRasterizer(NSVGrasterizer*);
 
+// Creates a pool of up to 'size' rasterizer contexts, for threads which render concurrently.
+NSVGrasterizerPool* nsvgCreateRasterizerPool(int size);
+
+// Checks a rasterizer out of the pool, without locking. The contexts are created on first use and
+// keep their buffers and settings between uses, so set the ones the render depends on. When all of
+// them are checked out, a new context is created and nsvgReleaseRasterizer() deletes it.
+// Returns NULL if out of memory.
+NSVGrasterizer* nsvgAcquireRasterizer(NSVGrasterizerPool* pool);
+
+// Gives a rasterizer back to the pool it was checked out of.
+void nsvgReleaseRasterizer(NSVGrasterizerPool* pool, NSVGrasterizer* r);
+
+// Deletes the pool and its rasterizers, none of them can be checked out.
+void nsvgDeleteRasterizerPool(NSVGrasterizerPool* pool);
+
 
 #ifndef NANOSVGRAST_CPLUSPLUS
 #ifdef __cplusplus
@@ -80,16 +251,57 @@ void nsvgDeleteRasterizer(NSVGrasterizer*);
 #include <stdlib.h>
 #include <string.h>
 
-#define NSVG__SUBSAMPLES	5
+// Define NSVG_NO_THREADS to build without thread support, nsvgRasterizeParallel() will then render
+// on the calling thread.
+#ifndef NSVG_NO_THREADS
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+#endif
+
+// Define NSVG_NO_SIMD to use only the scalar span code.
+#ifndef NSVG_NO_SIMD
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NSVG__SSE2
+#include <emmintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#define NSVG__AVX2
+#define NSVG__TARGET_AVX2
+#include <immintrin.h>
+#include <intrin.h>
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define NSVG__AVX2
+#define NSVG__TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+#endif
+#endif
+
+enum NSVGsimdLevel {
+	NSVG__SIMD_NONE = 0,
+	NSVG__SIMD_SSE2 = 1,
+	NSVG__SIMD_AVX2 = 2
+};
+
+#define NSVG__SUBSAMPLES	5		// Default number of sub-scanlines per pixel row
+#define NSVG__MAX_SUBSAMPLES	16
 #define NSVG__FIXSHIFT		10
 #define NSVG__FIX			(1 << NSVG__FIXSHIFT)
 #define NSVG__FIXMASK		(NSVG__FIX-1)
-#define NSVG__MEMPAGE_SIZE	1024
+#define NSVG__OCCLUSION_SHIFT	4	// Occlusion is tracked on tiles of 16x16 pixels.
+#define NSVG__GRADIENT_SPAN	256
+#define NSVG__HEIGHT		256		// Vertical resolution of NSVG_COVERAGE_ANALYTIC per pixel
+#define NSVG__AREASHIFT		16
+#define NSVG__AREA			(1 << NSVG__AREASHIFT)	// Full coverage, NSVG__HEIGHT * NSVG__HEIGHT
 
+// Edges are kept in the direction of the path, the winding direction follows from whether y increases.
 typedef struct NSVGedge {
 	float x0,y0, x1,y1;
-	int dir;
-	struct NSVGedge* next;
 } NSVGedge;
 
 typedef struct NSVGpoint {
@@ -100,22 +312,78 @@ typedef struct NSVGpoint {
 	unsigned char flags;
 } NSVGpoint;
 
-typedef struct NSVGactiveEdge {
-	int x,dx;
-	float ey;
-	int dir;
-	struct NSVGactiveEdge *next;
-} NSVGactiveEdge;
+// Edges crossing the current sub-scanline, sorted by x. The fields are kept in separate arrays
+// so that all edges can be stepped to the next sub-scanline together.
+typedef struct NSVGactiveEdges {
+	int* x;		// Fixed point position on the current sub-scanline.
+	int* dx;
+	float* ey;
+	int* dir;
+	float* ex;	// Top end point and slope, to place the edge exactly at the start of each pixel row.
+	float* ey0;
+	float* dxdy;
+	int nedges;
+	int cedges;
+} NSVGactiveEdges;
+
+// Coverage of a pixel touched by an edge, used by NSVG_COVERAGE_CELLS.
+typedef struct NSVGcell {
+	int x;
+	int cover;	// Coverage of this pixel only.
+	int delta;	// Change of coverage for this and all following pixels of the row.
+} NSVGcell;
+
+// Range of the cached edges of a shape's fill and stroke.
+typedef struct NSVGcachedShape {
+	int fill, nfill;
+	int stroke, nstroke;
+} NSVGcachedShape;
+
+// Sort record used while filling the cache, edges are cached in order of their top and emission.
+typedef struct NSVGorderedEdge {
+	NSVGedge edge;
+	float top;
+	int order;
+} NSVGorderedEdge;
+
+struct NSVGrasterCache
+{
+	const NSVGimage* image;
+	float scale;
+	float tessTol;
+	float distTol;
+	int flattening;
+
+	NSVGedge* edges;	// Scaled edges of all shapes, each range sorted by top.
+	int* order;			// Emission order of each edge within its range.
+	int nedges;
+	int cedges;
+
+	NSVGcachedShape* shapes;	// One per shape of the image, in document order.
+	int nshapes;
+	int cshapes;
+
+	NSVGorderedEdge* sort;
+	int csort;
+};
+
+// Gradient color tables kept by a rasterizer, gradients with more stops are not cached.
+#define NSVG__GRADIENT_CACHE		64
+#define NSVG__GRADIENT_CACHE_STOPS	16
 
-typedef struct NSVGmemPage {
-	unsigned char mem[NSVG__MEMPAGE_SIZE];
-	int size;
-	struct NSVGmemPage* next;
-} NSVGmemPage;
+typedef struct NSVGcachedGradient {
+	unsigned int hash;
+	float opacity;
+	int nstops;			// 0 for an unused entry.
+	NSVGgradientStop stops[NSVG__GRADIENT_CACHE_STOPS];
+	char opaque;
+	unsigned int colors[256];
+} NSVGcachedGradient;
 
 typedef struct NSVGcachedPaint {
 	signed char type;
 	char spread;
+	char opaque;
 	float xform[6];
 	unsigned int colors[256];
 } NSVGcachedPaint;
@@ -126,10 +394,18 @@ struct NSVGrasterizer
 
 	float tessTol;
 	float distTol;
+	int flattening;
+	int premultiplied;
+	int format;
+	int clear;
 
 	NSVGedge* edges;
 	int nedges;
 	int cedges;
+	NSVGedge* edges2;	// Sort buffer, swapped with edges.
+	int cedges2;
+	int* buckets;
+	int cbuckets;
 
 	NSVGpoint* points;
 	int npoints;
@@ -139,17 +415,96 @@ struct NSVGrasterizer
 	int npoints2;
 	int cpoints2;
 
-	NSVGactiveEdge* freelist;
-	NSVGmemPage* pages;
-	NSVGmemPage* curpage;
+	NSVGactiveEdges active;
 
 	unsigned char* scanline;
 	int cscanline;
 
+	int coverage;
+	int subsamples;
+	NSVGcell* cells;
+	NSVGcell* mcells;	// Merge buffer, same capacity as cells.
+	int ncells;
+	int ccells;
+
+	int* accum;		// Coverage differences of the current row, used by NSVG_COVERAGE_ANALYTIC.
+	int caccum;
+	int* aedges;	// Indices of the edges crossing the current row.
+	int naedges;
+	int caedges;
+
 	unsigned char* bitmap;
 	int width, height, stride;
+	int ox, oy;	// Image position of the first bitmap pixel, non-zero when rendering a band or a region.
+
+	// Set by nsvgRasterizeXform() for matrices that do more than scale and translate. The shapes are
+	// flattened and stroked at a uniform scale, and nsvg__addEdge() applies the remaining linear part.
+	int affine;
+	float xform[6];	// Image to pixels.
+	float linear[4];	// Remaining linear part, applied after the uniform scale.
+
+	struct NSVGrasterizer** workers;
+	int nworkers;
+
+	int simd;	// Instruction set used for compositing, see NSVGsimdLevel.
+	float unpremul[256];
+
+	NSVGcachedGradient* gradients;	// Color tables of the recently used gradients, indexed by hash.
+
+	int* dirty;				// Rectangles re-rendered by nsvgRasterizeDirty().
+	int cdirty;
+	unsigned char* scratch;	// Image the rectangles are rendered to when they need a border.
+	int cscratch;
+
+	int slot;	// Index+1 of the pool slot owning the rasterizer, 0 if it is not from a pool.
+
+	int occlusion;		// Skip shapes hidden by later opaque shapes, see nsvgRasterizerSetOcclusion().
+	const NSVGshape** shapes;	// The shapes of the image, walked back to front to find the hidden ones.
+	unsigned char* culled;	// Set for the hidden shapes, same capacity as shapes.
+	int cshapes;
+	unsigned char* tiles;	// Set for the tiles of the target which an opaque shape covers.
+	int ctiles;
+	float* occluder;	// Polygon of the occluding shape in pixels.
+	int coccluder;
 };
 
+static int nsvg__detectSimd(void)
+{
+#if defined(NSVG__AVX2) && defined(_MSC_VER) && !defined(__clang__)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] >= 7) {
+		__cpuid(info, 1);
+		// AVX2 needs the OS to save the YMM registers.
+		if ((info[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6) {
+			__cpuidex(info, 7, 0);
+			if (info[1] & (1 << 5))
+				return NSVG__SIMD_AVX2;
+		}
+	}
+	return NSVG__SIMD_SSE2;
+#elif defined(NSVG__AVX2)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return NSVG__SIMD_AVX2;
+	return NSVG__SIMD_SSE2;
+#elif defined(NSVG__SSE2)
+	return NSVG__SIMD_SSE2;
+#else
+	return NSVG__SIMD_NONE;
+#endif
+}
+
+// Fills the table of 255/a used to unpremultiply. It is biased up slightly, so that truncating c * 255/a
+// gives the same result as the integer division c*255/a for all c and a.
+static void nsvg__initUnpremultiply(float* inv)
+{
+	int a;
+	inv[0] = 1.0f;	// Leaves transparent pixels as they are.
+	for (a = 1; a < 256; a++)
+		inv[a] = 255.0f / (float)a * (1.0f + 1.0f / (1 << 20));
+}
+
 NSVGrasterizer* nsvgCreateRasterizer(void)
 {
 	NSVGrasterizer* r = (NSVGrasterizer*)malloc(sizeof(NSVGrasterizer));
@@ -158,6 +513,9 @@ NSVGrasterizer* nsvgCreateRasterizer(void)
 
 	r->tessTol = 0.25f;
 	r->distTol = 0.01f;
+	r->simd = nsvg__detectSimd();
+	r->subsamples = NSVG__SUBSAMPLES;
+	nsvg__initUnpremultiply(r->unpremul);
 
 	return r;
 
@@ -168,68 +526,107 @@ error:
 
 void nsvgDeleteRasterizer(NSVGrasterizer* r)
 {
-	NSVGmemPage* p;
-
 	if (r == NULL) return;
 
-	p = r->pages;
-	while (p != NULL) {
-		NSVGmemPage* next = p->next;
-		free(p);
-		p = next;
+	if (r->workers != NULL) {
+		int i;
+		for (i = 0; i < r->nworkers; i++)
+			nsvgDeleteRasterizer(r->workers[i]);
+		free(r->workers);
 	}
 
 	if (r->edges) free(r->edges);
+	if (r->edges2) free(r->edges2);
+	if (r->buckets) free(r->buckets);
 	if (r->points) free(r->points);
 	if (r->points2) free(r->points2);
 	if (r->scanline) free(r->scanline);
+	if (r->cells) free(r->cells);
+	if (r->mcells) free(r->mcells);
+	if (r->accum) free(r->accum);
+	if (r->aedges) free(r->aedges);
+	if (r->gradients) free(r->gradients);
+	if (r->dirty) free(r->dirty);
+	if (r->scratch) free(r->scratch);
+	if (r->shapes) free(r->shapes);
+	if (r->culled) free(r->culled);
+	if (r->tiles) free(r->tiles);
+	if (r->occluder) free(r->occluder);
+	if (r->active.x) free(r->active.x);
+	if (r->active.dx) free(r->active.dx);
+	if (r->active.ey) free(r->active.ey);
+	if (r->active.dir) free(r->active.dir);
+	if (r->active.ex) free(r->active.ex);
+	if (r->active.ey0) free(r->active.ey0);
+	if (r->active.dxdy) free(r->active.dxdy);
 
 	free(r);
 }
 
-static NSVGmemPage* nsvg__nextPage(NSVGrasterizer* r, NSVGmemPage* cur)
+void nsvgRasterizerSetCoverage(NSVGrasterizer* r, int coverage)
 {
-	NSVGmemPage *newp;
+	if (coverage == NSVG_COVERAGE_CELLS || coverage == NSVG_COVERAGE_ANALYTIC)
+		r->coverage = coverage;
+	else
+		r->coverage = NSVG_COVERAGE_SCANLINE;
+}
 
-	// If using existing chain, return the next page in chain
-	if (cur != NULL && cur->next != NULL) {
-		return cur->next;
-	}
+void nsvgRasterizerSetFlattening(NSVGrasterizer* r, int flattening)
+{
+	r->flattening = flattening == NSVG_FLATTEN_UNIFORM ? NSVG_FLATTEN_UNIFORM : NSVG_FLATTEN_SUBDIVIDE;
+}
+
+void nsvgRasterizerSetPremultiplied(NSVGrasterizer* r, int premultiplied)
+{
+	r->premultiplied = premultiplied ? 1 : 0;
+}
 
-	// Alloc new page
-	newp = (NSVGmemPage*)malloc(sizeof(NSVGmemPage));
-	if (newp == NULL) return NULL;
-	memset(newp, 0, sizeof(NSVGmemPage));
+void nsvgRasterizerSetFormat(NSVGrasterizer* r, int format)
+{
+	r->format = format >= NSVG_FORMAT_RGBA8 && format <= NSVG_FORMAT_MASK1 ? format : NSVG_FORMAT_RGBA8;
+}
 
-	// Add to linked list
-	if (cur != NULL)
-		cur->next = newp;
-	else
-		r->pages = newp;
+void nsvgRasterizerSetClear(NSVGrasterizer* r, int clear)
+{
+	r->clear = clear == NSVG_CLEAR_BOUNDS || clear == NSVG_CLEAR_NONE ? clear : NSVG_CLEAR_ALL;
+}
 
-	return newp;
+void nsvgRasterizerSetOcclusion(NSVGrasterizer* r, int enabled)
+{
+	r->occlusion = enabled ? 1 : 0;
 }
 
-static void nsvg__resetPool(NSVGrasterizer* r)
+void nsvgRasterizerSetSubsamples(NSVGrasterizer* r, int subsamples)
 {
-	NSVGmemPage* p = r->pages;
-	while (p != NULL) {
-		p->size = 0;
-		p = p->next;
-	}
-	r->curpage = r->pages;
+	if (subsamples < 1) subsamples = 1;
+	if (subsamples > NSVG__MAX_SUBSAMPLES) subsamples = NSVG__MAX_SUBSAMPLES;
+	r->subsamples = subsamples;
 }
 
-static unsigned char* nsvg__alloc(NSVGrasterizer* r, int size)
+// Grows a buffer to hold at least n items of 'size' bytes. Frees it and sets the capacity to 0 on failure.
+static void* nsvg__reserveBuffer(void* buf, int* cap, int n, int size)
 {
-	unsigned char* buf;
-	if (size > NSVG__MEMPAGE_SIZE) return NULL;
-	if (r->curpage == NULL || r->curpage->size+size > NSVG__MEMPAGE_SIZE) {
-		r->curpage = nsvg__nextPage(r, r->curpage);
+	void* p;
+	if (*cap >= n)
+		return buf;
+	p = realloc(buf, (size_t)n * size);
+	if (p == NULL) {
+		free(buf);
+		*cap = 0;
+		return NULL;
 	}
-	buf = &r->curpage->mem[r->curpage->size];
-	r->curpage->size += size;
-	return buf;
+	*cap = n;
+	return p;
+}
+
+// Frees a buffer if its capacity of items of 'size' bytes is more than maxBytes.
+static void* nsvg__trimBuffer(void* buf, int* cap, int size, int maxBytes)
+{
+	if (buf == NULL || (size_t)*cap * size <= (size_t)maxBytes)
+		return buf;
+	free(buf);
+	*cap = 0;
+	return NULL;
 }
 
 static int nsvg__ptEquals(float x1, float y1, float x2, float y2, float tol)
@@ -291,6 +688,15 @@ static void nsvg__addEdge(NSVGrasterizer* r, float x0, float y0, float x1, float
 {
 	NSVGedge* e;
 
+	if (r->affine) {
+		// Apply the rest of the transform, see nsvgRasterizeXform().
+		float* m = r->linear;
+		float ax = x0*m[0] + y0*m[2], ay = x0*m[1] + y0*m[3];
+		float bx = x1*m[0] + y1*m[2], by = x1*m[1] + y1*m[3];
+		x0 = ax; y0 = ay;
+		x1 = bx; y1 = by;
+	}
+
 	// Skip horizontal edges
 	if (y0 == y1)
 		return;
@@ -304,19 +710,27 @@ static void nsvg__addEdge(NSVGrasterizer* r, float x0, float y0, float x1, float
 	e = &r->edges[r->nedges];
 	r->nedges++;
 
-	if (y0 < y1) {
-		e->x0 = x0;
-		e->y0 = y0;
-		e->x1 = x1;
-		e->y1 = y1;
-		e->dir = 1;
-	} else {
-		e->x0 = x1;
-		e->y0 = y1;
-		e->x1 = x0;
-		e->y1 = y0;
-		e->dir = -1;
+	e->x0 = x0;
+	e->y0 = y0;
+	e->x1 = x1;
+	e->y1 = y1;
+}
+
+static float nsvg__edgeTop(const NSVGedge* e) { return e->y0 < e->y1 ? e->y0 : e->y1; }
+static float nsvg__edgeBottom(const NSVGedge* e) { return e->y0 < e->y1 ? e->y1 : e->y0; }
+
+// Returns the edge going down in 'down', and the winding direction.
+static int nsvg__orientEdge(const NSVGedge* e, NSVGedge* down)
+{
+	if (e->y0 < e->y1) {
+		*down = *e;
+		return 1;
 	}
+	down->x0 = e->x1;
+	down->y0 = e->y1;
+	down->x1 = e->x0;
+	down->y1 = e->y0;
+	return -1;
 }
 
 static float nsvg__normalize(float *x, float* y)
@@ -371,18 +785,151 @@ static void nsvg__flattenCubicBez(NSVGrasterizer* r,
 	nsvg__flattenCubicBez(r, x1234,y1234, x234,y234, x34,y34, x4,y4, level+1, type);
 }
 
-static void nsvg__flattenShape(NSVGrasterizer* r, NSVGshape* shape, float scale)
+// Flattens the curve into evenly spaced segments without recursion. The segment count follows
+// from Wang's formula: a cubic stays within d of its chords when split into sqrt(3/4 * M / d) pieces,
+// where M is the length of the largest second difference of the control points.
+// The tolerance d matches the worst case of the subdivision test, 3/4 * sqrt(tessTol).
+static void nsvg__flattenCubicBezUniform(NSVGrasterizer* r,
+										 float x1, float y1, float x2, float y2,
+										 float x3, float y3, float x4, float y4,
+										 int type)
+{
+	float ddx0 = x1 - 2*x2 + x3, ddy0 = y1 - 2*y2 + y3;
+	float ddx1 = x2 - 2*x3 + x4, ddy1 = y2 - 2*y3 + y4;
+	float dd0 = ddx0*ddx0 + ddy0*ddy0, dd1 = ddx1*ddx1 + ddy1*ddy1;
+	float tol = 0.75f * sqrtf(r->tessTol);
+	float n = ceilf(sqrtf(0.75f * sqrtf(dd0 > dd1 ? dd0 : dd1) / tol));
+	float dx = x4 - x1, dy = y4 - y1;
+	float d2 = nsvg__absf((x2 - x4) * dy - (y2 - y4) * dx);
+	float d3 = nsvg__absf((x3 - x4) * dy - (y3 - y4) * dx);
+	float h, h2, h3, ax, ay, bx, by, cx, cy;
+	float fx, fy, dfx, dfy, ddfx, ddfy, dddfx, dddfy;
+	int i, count;
+
+	// The bound does not see that unevenly spaced control points on the chord make a straight line.
+	if ((d2 + d3)*(d2 + d3) < r->tessTol * (dx*dx + dy*dy))
+		count = 1;
+	else
+		count = n > 1.0f ? (n < 1024.0f ? (int)n : 1024) : 1;
+	h = 1.0f / count;
+	h2 = h*h;
+	h3 = h2*h;
+
+	// Power basis, B(t) = a t^3 + b t^2 + c t + p1.
+	ax = -x1 + 3*x2 - 3*x3 + x4;
+	ay = -y1 + 3*y2 - 3*y3 + y4;
+	bx = 3*x1 - 6*x2 + 3*x3;
+	by = 3*y1 - 6*y2 + 3*y3;
+	cx = 3*(x2 - x1);
+	cy = 3*(y2 - y1);
+
+	fx = x1; fy = y1;
+	dfx = ax*h3 + bx*h2 + cx*h;
+	dfy = ay*h3 + by*h2 + cy*h;
+	ddfx = 6*ax*h3 + 2*bx*h2;
+	ddfy = 6*ay*h3 + 2*by*h2;
+	dddfx = 6*ax*h3;
+	dddfy = 6*ay*h3;
+
+	for (i = 1; i < count; i++) {
+		fx += dfx; fy += dfy;
+		dfx += ddfx; dfy += ddfy;
+		ddfx += dddfx; ddfy += dddfy;
+		nsvg__addPathPoint(r, fx, fy, 0);
+	}
+	// End exactly at the end point, whatever rounding accumulated on the way.
+	nsvg__addPathPoint(r, x4, y4, type);
+}
+
+static void nsvg__flattenCubic(NSVGrasterizer* r, const float* p, float scale, int type)
+{
+	if (r->flattening == NSVG_FLATTEN_UNIFORM)
+		nsvg__flattenCubicBezUniform(r, p[0]*scale,p[1]*scale, p[2]*scale,p[3]*scale, p[4]*scale,p[5]*scale, p[6]*scale,p[7]*scale, type);
+	else
+		nsvg__flattenCubicBez(r, p[0]*scale,p[1]*scale, p[2]*scale,p[3]*scale, p[4]*scale,p[5]*scale, p[6]*scale,p[7]*scale, 0, type);
+}
+
+// Returns in out the image space bounds that a shape with the given bounds, grown by 'pad' pixels,
+// can draw to.
+static void nsvg__pixelBounds(NSVGrasterizer* r, const float* bounds, float tx, float ty, float scale, float pad, float* out)
+{
+	float x0, y0, x1, y1, slackx;
+
+	if (r->affine) {
+		// Bounds of the transformed corners. The remaining linear part does not stretch, see
+		// nsvgRasterizeXform(), so the padding applies as is.
+		float* m = r->linear;
+		float cx[4], cy[4];
+		int i;
+		for (i = 0; i < 4; i++) {
+			float x = bounds[i & 1 ? 2 : 0] * scale, y = bounds[i & 2 ? 3 : 1] * scale;
+			cx[i] = x*m[0] + y*m[2];
+			cy[i] = x*m[1] + y*m[3];
+		}
+		x0 = x1 = cx[0];
+		y0 = y1 = cy[0];
+		for (i = 1; i < 4; i++) {
+			if (cx[i] < x0) x0 = cx[i];
+			if (cx[i] > x1) x1 = cx[i];
+			if (cy[i] < y0) y0 = cy[i];
+			if (cy[i] > y1) y1 = cy[i];
+		}
+		x0 += tx - pad;
+		y0 += ty - pad;
+		x1 += tx + pad;
+		y1 += ty + pad;
+	} else {
+		x0 = bounds[0]*scale + tx - pad;
+		y0 = bounds[1]*scale + ty - pad;
+		x1 = bounds[2]*scale + tx + pad;
+		y1 = bounds[3]*scale + ty + pad;
+	}
+	// Allow a pixel of slack for the flattened curves, horizontally also the worst case error
+	// accumulated by stepping the edges in fixed point.
+	slackx = 1.0f + ((y1 - y0) * r->subsamples + 1.0f) * (0.5f / NSVG__FIX);
+	out[0] = x0 - slackx;
+	out[1] = y0 - 1.0f;
+	out[2] = x1 + slackx;
+	out[3] = y1 + 1.0f;
+}
+
+// Returns 1 if the bounds grown by 'pad' pixels overlap the destination.
+// Without a destination, when filling a geometry cache, everything is visible.
+static int nsvg__boundsVisible(NSVGrasterizer* r, const float* bounds, float tx, float ty, float scale, float pad)
+{
+	float b[4];
+
+	if (r->bitmap == NULL)
+		return 1;
+
+	nsvg__pixelBounds(r, bounds, tx, ty, scale, pad, b);
+	return !(b[2] < (float)r->ox || b[3] < (float)r->oy ||
+			 b[0] > (float)(r->ox + r->width) || b[1] > (float)(r->oy + r->height));
+}
+
+// Returns how far the stroke outline can reach outside the path. Miter joins are limited by the miter limit,
+// other joins by the extrusion clamp in nsvg__prepareStroke(), which allows up to sqrt(600) half widths.
+static float nsvg__strokeExtent(const NSVGshape* shape, float scale)
+{
+	float limit = shape->miterLimit > 25.0f ? shape->miterLimit : 25.0f;
+	return shape->strokeWidth * scale * 0.5f * limit;
+}
+
+static void nsvg__flattenShape(NSVGrasterizer* r, const NSVGshape* shape, float tx, float ty, float scale)
 {
 	int i, j;
-	NSVGpath* path;
+	const NSVGpath* path;
 
 	for (path = shape->paths; path != NULL; path = path->next) {
+		// Closed paths outside the destination do not change the winding inside it.
+		if (!nsvg__boundsVisible(r, path->bounds, tx, ty, scale, 0.0f))
+			continue;
 		r->npoints = 0;
 		// Flatten path
 		nsvg__addPathPoint(r, path->pts[0]*scale, path->pts[1]*scale, 0);
 		for (i = 0; i < path->npts-1; i += 3) {
-			float* p = &path->pts[i*2];
-			nsvg__flattenCubicBez(r, p[0]*scale,p[1]*scale, p[2]*scale,p[3]*scale, p[4]*scale,p[5]*scale, p[6]*scale,p[7]*scale, 0, 0);
+			const float* p = &path->pts[i*2];
+			nsvg__flattenCubic(r, p, scale, 0);
 		}
 		// Close path
 		nsvg__addPathPoint(r, path->pts[0]*scale, path->pts[1]*scale, 0);
@@ -735,23 +1282,27 @@ static void nsvg__prepareStroke(NSVGrasterizer* r, float miterLimit, int lineJoi
 	}
 }
 
-static void nsvg__flattenShapeStroke(NSVGrasterizer* r, NSVGshape* shape, float scale)
+static void nsvg__flattenShapeStroke(NSVGrasterizer* r, const NSVGshape* shape, float tx, float ty, float scale)
 {
 	int i, j, closed;
-	NSVGpath* path;
+	const NSVGpath* path;
 	NSVGpoint* p0, *p1;
 	float miterLimit = shape->miterLimit;
 	int lineJoin = shape->strokeLineJoin;
 	int lineCap = shape->strokeLineCap;
 	float lineWidth = shape->strokeWidth * scale;
+	float extent = nsvg__strokeExtent(shape, scale);
 
 	for (path = shape->paths; path != NULL; path = path->next) {
+		// The stroke outlines are closed, and can be skipped when outside the destination.
+		if (!nsvg__boundsVisible(r, path->bounds, tx, ty, scale, extent))
+			continue;
 		// Flatten path
 		r->npoints = 0;
 		nsvg__addPathPoint(r, path->pts[0]*scale, path->pts[1]*scale, NSVG_PT_CORNER);
 		for (i = 0; i < path->npts-1; i += 3) {
-			float* p = &path->pts[i*2];
-			nsvg__flattenCubicBez(r, p[0]*scale,p[1]*scale, p[2]*scale,p[3]*scale, p[4]*scale,p[5]*scale, p[6]*scale,p[7]*scale, 0, NSVG_PT_CORNER);
+			const float* p = &path->pts[i*2];
+			nsvg__flattenCubic(r, p, scale, NSVG_PT_CORNER);
 		}
 		if (r->npoints < 2)
 			continue;
@@ -835,8 +1386,10 @@ static void nsvg__flattenShapeStroke(NSVGrasterizer* r, NSVGshape* shape, float
 				}
 			}
 			// Stroke any leftover path
-			if (r->npoints > 1 && dashState)
+			if (r->npoints > 1 && dashState) {
+				nsvg__prepareStroke(r, miterLimit, lineJoin);
 				nsvg__expandStroke(r, r->points, r->npoints, 0, lineJoin, lineCap, lineWidth);
+			}
 		} else {
 			nsvg__prepareStroke(r, miterLimit, lineJoin);
 			nsvg__expandStroke(r, r->points, r->npoints, closed, lineJoin, lineCap, lineWidth);
@@ -849,46 +1402,263 @@ static int nsvg__cmpEdge(const void *p, const void *q)
 	const NSVGedge* a = (const NSVGedge*)p;
 	const NSVGedge* b = (const NSVGedge*)q;
 
-	if (a->y0 < b->y0) return -1;
-	if (a->y0 > b->y0) return  1;
+	float ya = nsvg__edgeTop(a), yb = nsvg__edgeTop(b);
+
+	if (ya < yb) return -1;
+	if (ya > yb) return  1;
 	return 0;
 }
 
+static int nsvg__edgeBucket(float y0, float top, float ymin, float scale, int n)
+{
+	float b = ((y0 < top ? top : y0) - ymin) * scale;
+	// Written so that a NaN ends up in the first bucket.
+	if (!(b > 0.0f)) return 0;
+	return b < (float)(n-1) ? (int)b : n-1;
+}
 
-static NSVGactiveEdge* nsvg__addActive(NSVGrasterizer* r, NSVGedge* e, float startPoint)
+// Sorts the edges by their top in linear time. The edges are counted into as many buckets as there are edges,
+// spread evenly over the rows they start on, and the few edges sharing a bucket are then sorted in place.
+// Edges starting above the destination share the first bucket. The order of edges with equal tops is kept.
+static void nsvg__sortEdges(NSVGrasterizer* r)
 {
-	 NSVGactiveEdge* z;
+	float top = (float)((r->oy - 1) * r->subsamples);
+	float ymin = 1e30f, ymax = -1e30f, scale;
+	int i, j, b, n = r->nedges;
+	int* count;
+	NSVGedge* tmp;
 
-	if (r->freelist != NULL) {
-		// Restore from freelist.
-		z = r->freelist;
-		r->freelist = z->next;
-	} else {
-		// Alloc new edge.
-		z = (NSVGactiveEdge*)nsvg__alloc(r, sizeof(NSVGactiveEdge));
-		if (z == NULL) return NULL;
+	if (n < 2)
+		return;
+
+	for (i = 0; i < n; i++) {
+		float y = nsvg__edgeTop(&r->edges[i]);
+		if (y < top) y = top;
+		if (y < ymin) ymin = y;
+		if (y > ymax) ymax = y;
+	}
+	scale = ymax > ymin ? (float)(n-1) / (ymax - ymin) : 0.0f;
+
+	if (r->cbuckets < n+1) {
+		r->cbuckets = n+1;
+		r->buckets = (int*)realloc(r->buckets, sizeof(int) * r->cbuckets);
+		if (r->buckets == NULL) return;
+	}
+	if (r->cedges2 < n) {
+		r->cedges2 = r->cedges;
+		r->edges2 = (NSVGedge*)realloc(r->edges2, sizeof(NSVGedge) * r->cedges2);
+		if (r->edges2 == NULL) return;
+	}
+
+	// Count the edges per bucket, and turn the counts into bucket start indices.
+	count = r->buckets;
+	memset(count, 0, sizeof(int) * (n+1));
+	for (i = 0; i < n; i++)
+		count[nsvg__edgeBucket(nsvg__edgeTop(&r->edges[i]), top, ymin, scale, n) + 1]++;
+	for (b = 0; b < n; b++)
+		count[b+1] += count[b];
+
+	for (i = 0; i < n; i++)
+		r->edges2[count[nsvg__edgeBucket(nsvg__edgeTop(&r->edges[i]), top, ymin, scale, n)]++] = r->edges[i];
+
+	tmp = r->edges; r->edges = r->edges2; r->edges2 = tmp;
+	b = r->cedges; r->cedges = r->cedges2; r->cedges2 = b;
+
+	// Each bucket now ends where the next one starts, sort within the buckets.
+	for (b = 0; b < n; b++) {
+		int start = b > 0 ? count[b-1] : 0, end = count[b];
+		if (end - start > 32) {
+			qsort(&r->edges[start], end - start, sizeof(NSVGedge), nsvg__cmpEdge);
+			continue;
+		}
+		for (i = start+1; i < end; i++) {
+			NSVGedge e = r->edges[i];
+			float y = nsvg__edgeTop(&e);
+			for (j = i; j > start && nsvg__edgeTop(&r->edges[j-1]) > y; j--)
+				r->edges[j] = r->edges[j-1];
+			r->edges[j] = e;
+		}
+	}
+}
+
+
+static int nsvg__reserveActive(NSVGrasterizer* r, int n)
+{
+	NSVGactiveEdges* a = &r->active;
+	if (a->cedges >= n)
+		return 1;
+	a->x = (int*)realloc(a->x, sizeof(int) * n);
+	a->dx = (int*)realloc(a->dx, sizeof(int) * n);
+	a->ey = (float*)realloc(a->ey, sizeof(float) * n);
+	a->dir = (int*)realloc(a->dir, sizeof(int) * n);
+	a->ex = (float*)realloc(a->ex, sizeof(float) * n);
+	a->ey0 = (float*)realloc(a->ey0, sizeof(float) * n);
+	a->dxdy = (float*)realloc(a->dxdy, sizeof(float) * n);
+	if (a->x == NULL || a->dx == NULL || a->ey == NULL || a->dir == NULL ||
+		a->ex == NULL || a->ey0 == NULL || a->dxdy == NULL) {
+		a->cedges = 0;
+		return 0;
 	}
+	a->cedges = n;
+	return 1;
+}
+
+// Returns the fixed point position on sub-scanline 'scany' of an edge with top end point x0,y0.
+static int nsvg__edgeX(float x0, float y0, float dxdy, float scany)
+{
+	return (int)nsvg__roundf(NSVG__FIX * (x0 + dxdy * (scany - y0)));
+}
+
+// Inserts the edge at its position for sub-scanline 'startPoint', advanced by 'steps' sub-scanlines.
+static void nsvg__addActive(NSVGrasterizer* r, NSVGedge* edge, float startPoint, int steps)
+{
+	NSVGactiveEdges* a = &r->active;
+	int x, dx, i, n = a->nedges;
+	NSVGedge e;
+	int dir = nsvg__orientEdge(edge, &e);
 
-	float dxdy = (e->x1 - e->x0) / (e->y1 - e->y0);
-//	STBTT_assert(e->y0 <= start_point);
+	float dxdy = (e.x1 - e.x0) / (e.y1 - e.y0);
+//	STBTT_assert(e.y0 <= start_point);
 	// round dx down to avoid going too far
 	if (dxdy < 0)
-		z->dx = (int)(-nsvg__roundf(NSVG__FIX * -dxdy));
+		dx = (int)(-nsvg__roundf(NSVG__FIX * -dxdy));
 	else
-		z->dx = (int)nsvg__roundf(NSVG__FIX * dxdy);
-	z->x = (int)nsvg__roundf(NSVG__FIX * (e->x0 + dxdy * (startPoint - e->y0)));
-//	z->x -= off_x * FIX;
-	z->ey = e->y1;
-	z->next = 0;
-	z->dir = e->dir;
+		dx = (int)nsvg__roundf(NSVG__FIX * dxdy);
+	x = nsvg__edgeX(e.x0, e.y0, dxdy, startPoint) + steps * dx;
+
+	// Find insertion point. The first edge is passed over when equal, the rest are inserted before,
+	// keeping the order of coincident edges the same as with the list the table used to be.
+	if (n == 0 || x < a->x[0]) {
+		i = 0;
+	} else {
+		int lo = 1, hi = n;
+		while (lo < hi) {
+			int mid = (lo + hi) >> 1;
+			if (a->x[mid] < x)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		i = lo;
+	}
+	if (i < n) {
+		memmove(&a->x[i+1], &a->x[i], sizeof(int) * (n - i));
+		memmove(&a->dx[i+1], &a->dx[i], sizeof(int) * (n - i));
+		memmove(&a->ey[i+1], &a->ey[i], sizeof(float) * (n - i));
+		memmove(&a->dir[i+1], &a->dir[i], sizeof(int) * (n - i));
+		memmove(&a->ex[i+1], &a->ex[i], sizeof(float) * (n - i));
+		memmove(&a->ey0[i+1], &a->ey0[i], sizeof(float) * (n - i));
+		memmove(&a->dxdy[i+1], &a->dxdy[i], sizeof(float) * (n - i));
+	}
+	a->x[i] = x;
+	a->dx[i] = dx;
+	a->ey[i] = e.y1;
+	a->dir[i] = dir;
+	a->ex[i] = e.x0;
+	a->ey0[i] = e.y0;
+	a->dxdy[i] = dxdy;
+	a->nedges++;
+}
+
+// Removes the edges which end above the sub-scanline 'scany' and steps the rest to it. With 'exact'
+// the edges are placed from their end points instead, the rounding of dx then only adds up within
+// a pixel row, whatever the number of sub-scanlines.
+static void nsvg__stepActive(NSVGrasterizer* r, float scany, int exact)
+{
+	NSVGactiveEdges* a = &r->active;
+	int i = 0, n;
+
+	// Compact the arrays only from the first edge which ends.
+	while (i < a->nedges && a->ey[i] > scany)
+		i++;
+	for (n = i; i < a->nedges; i++) {
+		if (a->ey[i] > scany) {
+			a->x[n] = a->x[i];
+			a->dx[n] = a->dx[i];
+			a->ey[n] = a->ey[i];
+			a->dir[n] = a->dir[i];
+			a->ex[n] = a->ex[i];
+			a->ey0[n] = a->ey0[i];
+			a->dxdy[n] = a->dxdy[i];
+			n++;
+		}
+	}
+	a->nedges = n;
+
+	if (exact) {
+		for (i = 0; i < n; i++)
+			a->x[i] = nsvg__edgeX(a->ex[i], a->ey0[i], a->dxdy[i], scany);
+		return;
+	}
+
+	i = 0;
+#ifdef NSVG__SSE2
+	for (; i+8 <= n; i += 8) {
+		__m128i x0 = _mm_loadu_si128((__m128i*)&a->x[i]);
+		__m128i x1 = _mm_loadu_si128((__m128i*)&a->x[i+4]);
+		x0 = _mm_add_epi32(x0, _mm_loadu_si128((__m128i*)&a->dx[i]));
+		x1 = _mm_add_epi32(x1, _mm_loadu_si128((__m128i*)&a->dx[i+4]));
+		_mm_storeu_si128((__m128i*)&a->x[i], x0);
+		_mm_storeu_si128((__m128i*)&a->x[i+4], x1);
+	}
+#endif
+	for (; i < n; i++)
+		a->x[i] += a->dx[i];
+}
+
+// Restores the order after stepping. Edges rarely cross, so the insertion sort is close to linear.
+static void nsvg__sortActive(NSVGrasterizer* r)
+{
+	NSVGactiveEdges* a = &r->active;
+	int i, j;
+
+	for (i = 1; i < a->nedges; i++) {
+		int x = a->x[i], dx, dir;
+		float ey, ex, ey0, dxdy;
+		if (a->x[i-1] <= x)
+			continue;
+		dx = a->dx[i]; ey = a->ey[i]; dir = a->dir[i];
+		ex = a->ex[i]; ey0 = a->ey0[i]; dxdy = a->dxdy[i];
+		for (j = i; j > 0 && a->x[j-1] > x; j--) {
+			a->x[j] = a->x[j-1];
+			a->dx[j] = a->dx[j-1];
+			a->ey[j] = a->ey[j-1];
+			a->dir[j] = a->dir[j-1];
+			a->ex[j] = a->ex[j-1];
+			a->ey0[j] = a->ey0[j-1];
+			a->dxdy[j] = a->dxdy[j-1];
+		}
+		a->x[j] = x; a->dx[j] = dx; a->ey[j] = ey; a->dir[j] = dir;
+		a->ex[j] = ex; a->ey0[j] = ey0; a->dxdy[j] = dxdy;
+	}
+}
 
-	return z;
+// Returns index of the first sub-scanline at or below y which is not above the first sub-scanline 'first'.
+static int nsvg__firstSample(float y, int first)
+{
+	if (y - 0.5f <= (float)first)
+		return first;
+	return (int)ceilf(y - 0.5f);
 }
 
-static void nsvg__freeActive(NSVGrasterizer* r, NSVGactiveEdge* z)
+// Builds the active edge list as it would be after stepping through every sub-scanline above 'sample',
+// starting at sub-scanline 'first'. This lets a band continue exactly where a full pass would be.
+// Returns index of the first edge which is not yet inserted.
+static int nsvg__primeActiveEdges(NSVGrasterizer* r, int first, int sample)
 {
-	z->next = r->freelist;
-	r->freelist = z;
+	float prev = (float)(sample-1) + 0.5f;
+	int e = 0;
+
+	while (e < r->nedges && nsvg__edgeTop(&r->edges[e]) <= prev) {
+		if (nsvg__edgeBottom(&r->edges[e]) > prev) {
+			int k = nsvg__firstSample(nsvg__edgeTop(&r->edges[e]), first);
+			// advance to position for the previous scanline
+			nsvg__addActive(r, &r->edges[e], (float)k + 0.5f, sample-1 - k);
+		}
+		e++;
+	}
+
+	return e;
 }
 
 static void nsvg__fillScanline(unsigned char* scanline, int len, int x0, int x1, int maxWeight, int* xmin, int* xmax)
@@ -918,40 +1688,114 @@ static void nsvg__fillScanline(unsigned char* scanline, int len, int x0, int x1,
 	}
 }
 
+static void nsvg__addCell(NSVGrasterizer* r, int x, int cover, int delta)
+{
+	NSVGcell* c;
+
+	if (r->ncells+1 > r->ccells) {
+		r->ccells = r->ccells > 0 ? r->ccells * 2 : 64;
+		r->cells = (NSVGcell*)realloc(r->cells, sizeof(NSVGcell) * r->ccells);
+		r->mcells = (NSVGcell*)realloc(r->mcells, sizeof(NSVGcell) * r->ccells);
+		if (r->cells == NULL || r->mcells == NULL) return;
+	}
+
+	c = &r->cells[r->ncells];
+	r->ncells++;
+	c->x = x;
+	c->cover = cover;
+	c->delta = delta;
+}
+
+// Same as nsvg__fillScanline(), but records the span as cells. The pixels between
+// the end points are covered by a delta, so the cost does not depend on the span length.
+static void nsvg__fillCells(NSVGrasterizer* r, int x0, int x1, int maxWeight)
+{
+	int len = r->width;
+	int i = x0 >> NSVG__FIXSHIFT;
+	int j = x1 >> NSVG__FIXSHIFT;
+	if (i < len && j >= 0) {
+		if (i == j) {
+			// x0,x1 are the same pixel, so compute combined coverage
+			nsvg__addCell(r, i, (x1 - x0) * maxWeight >> NSVG__FIXSHIFT, 0);
+		} else {
+			if (i >= 0) // add antialiasing for x0
+				nsvg__addCell(r, i, ((NSVG__FIX - (x0 & NSVG__FIXMASK)) * maxWeight) >> NSVG__FIXSHIFT, 0);
+			else
+				i = -1; // clip
+
+			if (i+1 < j && i+1 < len) // fill pixels between x0 and x1
+				nsvg__addCell(r, i+1, 0, maxWeight);
+
+			if (j < len) // add antialiasing for x1, and end the fill
+				nsvg__addCell(r, j, ((x1 & NSVG__FIXMASK) * maxWeight) >> NSVG__FIXSHIFT, i+1 < j ? -maxWeight : 0);
+		}
+	}
+}
+
+// Merges the cells added for the last sub-scanline, starting at index first, into the cells
+// of the row. Both are sorted by x, since the active edges are, and each pixel ends up in one cell.
+static void nsvg__mergeCells(NSVGrasterizer* r, int first)
+{
+	NSVGcell* a = r->cells;
+	NSVGcell* b = &r->cells[first];
+	NSVGcell* aend = b;
+	NSVGcell* bend = &r->cells[r->ncells];
+	NSVGcell* out = r->mcells;
+	int n = 0;
+
+	while (a < aend || b < bend) {
+		NSVGcell* c = (b >= bend || (a < aend && a->x <= b->x)) ? a++ : b++;
+		if (n > 0 && out[n-1].x == c->x) {
+			out[n-1].cover += c->cover;
+			out[n-1].delta += c->delta;
+		} else {
+			out[n++] = *c;
+		}
+	}
+
+	r->mcells = r->cells;
+	r->cells = out;
+	r->ncells = n;
+}
+
+static void nsvg__accumulateSpan(NSVGrasterizer* r, int x0, int x1, int maxWeight, int* xmin, int* xmax)
+{
+	if (r->coverage == NSVG_COVERAGE_CELLS)
+		nsvg__fillCells(r, x0, x1, maxWeight);
+	else
+		nsvg__fillScanline(r->scanline, r->width, x0, x1, maxWeight, xmin, xmax);
+}
+
 // note: this routine clips fills that extend off the edges... ideally this
 // wouldn't happen, but it could happen if the truetype glyph bounding boxes
 // are wrong, or if the user supplies a too-small bitmap
-static void nsvg__fillActiveEdges(unsigned char* scanline, int len, NSVGactiveEdge* e, int maxWeight, int* xmin, int* xmax, char fillRule)
+static void nsvg__fillActiveEdges(NSVGrasterizer* r, int maxWeight, int* xmin, int* xmax, char fillRule)
 {
 	// non-zero winding fill
-	int x0 = 0, w = 0;
+	int x0 = 0, w = 0, open = 0, i;
+	int offset = r->ox * NSVG__FIX;
+	NSVGactiveEdges* a = &r->active;
 
 	if (fillRule == NSVG_FILLRULE_NONZERO) {
 		// Non-zero
-		while (e != NULL) {
-			if (w == 0) {
+		for (i = 0; i < a->nedges; i++) {
+			if (!open) {
 				// if we're currently at zero, we need to record the edge start point
-				x0 = e->x; w += e->dir;
-			} else {
-				int x1 = e->x; w += e->dir;
-				// if we went to zero, we need to draw
-				if (w == 0)
-					nsvg__fillScanline(scanline, len, x0, x1, maxWeight, xmin, xmax);
+				x0 = a->x[i] - offset;
+				open = 1;
+			}
+			w += a->dir[i];
+			// if we went to zero, we need to draw. The order of edges at the same x depends on
+			// when they were inserted, so the span is only closed after the last of them.
+			if (w == 0 && (i+1 == a->nedges || a->x[i+1] != a->x[i])) {
+				nsvg__accumulateSpan(r, x0, a->x[i] - offset, maxWeight, xmin, xmax);
+				open = 0;
 			}
-			e = e->next;
 		}
 	} else if (fillRule == NSVG_FILLRULE_EVENODD) {
 		// Even-odd
-		while (e != NULL) {
-			if (w == 0) {
-				// if we're currently at zero, we need to record the edge start point
-				x0 = e->x; w = 1;
-			} else {
-				int x1 = e->x; w = 0;
-				nsvg__fillScanline(scanline, len, x0, x1, maxWeight, xmin, xmax);
-			}
-			e = e->next;
-		}
+		for (i = 0; i+1 < a->nedges; i += 2)
+			nsvg__accumulateSpan(r, a->x[i] - offset, a->x[i+1] - offset, maxWeight, xmin, xmax);
 	}
 }
 
@@ -991,478 +1835,2599 @@ static inline int nsvg__div255(int x)
     return ((x+1) * 257) >> 16;
 }
 
-static void nsvg__scanlineSolid(unsigned char* dst, int count, unsigned char* cover, int x, int y,
-								float tx, float ty, float scale, NSVGcachedPaint* cache)
+static inline void nsvg__blendPixel(unsigned char* dst, int cover, unsigned int c)
 {
+	int r,g,b;
+	int a = nsvg__div255(cover * (int)((c >> 24) & 0xff));
+	int ia = 255 - a;
+	// Premultiply
+	r = nsvg__div255((int)(c & 0xff) * a);
+	g = nsvg__div255((int)((c >> 8) & 0xff) * a);
+	b = nsvg__div255((int)((c >> 16) & 0xff) * a);
+
+	// Blend over
+	r += nsvg__div255(ia * (int)dst[0]);
+	g += nsvg__div255(ia * (int)dst[1]);
+	b += nsvg__div255(ia * (int)dst[2]);
+	a += nsvg__div255(ia * (int)dst[3]);
+
+	dst[0] = (unsigned char)r;
+	dst[1] = (unsigned char)g;
+	dst[2] = (unsigned char)b;
+	dst[3] = (unsigned char)a;
+}
 
-	if (cache->type == NSVG_PAINT_COLOR) {
-		int i, cr, cg, cb, ca;
-		cr = cache->colors[0] & 0xff;
-		cg = (cache->colors[0] >> 8) & 0xff;
-		cb = (cache->colors[0] >> 16) & 0xff;
-		ca = (cache->colors[0] >> 24) & 0xff;
-
-		for (i = 0; i < count; i++) {
-			int r,g,b;
-			int a = nsvg__div255((int)cover[0] * ca);
-			int ia = 255 - a;
-			// Premultiply
-			r = nsvg__div255(cr * a);
-			g = nsvg__div255(cg * a);
-			b = nsvg__div255(cb * a);
-
-			// Blend over
-			r += nsvg__div255(ia * (int)dst[0]);
-			g += nsvg__div255(ia * (int)dst[1]);
-			b += nsvg__div255(ia * (int)dst[2]);
-			a += nsvg__div255(ia * (int)dst[3]);
-
-			dst[0] = (unsigned char)r;
-			dst[1] = (unsigned char)g;
-			dst[2] = (unsigned char)b;
-			dst[3] = (unsigned char)a;
-
-			cover++;
-			dst += 4;
-		}
-	} else if (cache->type == NSVG_PAINT_LINEAR_GRADIENT) {
-		// TODO: spread modes.
-		// TODO: plenty of opportunities to optimize.
-		float fx, fy, dx, gy;
-		float* t = cache->xform;
-		int i, cr, cg, cb, ca;
-		unsigned int c;
-
-		fx = ((float)x - tx) / scale;
-		fy = ((float)y - ty) / scale;
-		dx = 1.0f / scale;
-
-		for (i = 0; i < count; i++) {
-			int r,g,b,a,ia;
-			gy = fx*t[1] + fy*t[3] + t[5];
-			c = cache->colors[(int)nsvg__clampf(gy*255.0f, 0, 255.0f)];
-			cr = (c) & 0xff;
-			cg = (c >> 8) & 0xff;
-			cb = (c >> 16) & 0xff;
-			ca = (c >> 24) & 0xff;
-
-			a = nsvg__div255((int)cover[0] * ca);
-			ia = 255 - a;
-
-			// Premultiply
-			r = nsvg__div255(cr * a);
-			g = nsvg__div255(cg * a);
-			b = nsvg__div255(cb * a);
-
-			// Blend over
-			r += nsvg__div255(ia * (int)dst[0]);
-			g += nsvg__div255(ia * (int)dst[1]);
-			b += nsvg__div255(ia * (int)dst[2]);
-			a += nsvg__div255(ia * (int)dst[3]);
-
-			dst[0] = (unsigned char)r;
-			dst[1] = (unsigned char)g;
-			dst[2] = (unsigned char)b;
-			dst[3] = (unsigned char)a;
-
-			cover++;
-			dst += 4;
-			fx += dx;
-		}
-	} else if (cache->type == NSVG_PAINT_RADIAL_GRADIENT) {
-		// TODO: spread modes.
-		// TODO: plenty of opportunities to optimize.
-		// TODO: focus (fx,fy)
-		float fx, fy, dx, gx, gy, gd;
-		float* t = cache->xform;
-		int i, cr, cg, cb, ca;
-		unsigned int c;
-
-		fx = ((float)x - tx) / scale;
-		fy = ((float)y - ty) / scale;
-		dx = 1.0f / scale;
-
-		for (i = 0; i < count; i++) {
-			int r,g,b,a,ia;
-			gx = fx*t[0] + fy*t[2] + t[4];
-			gy = fx*t[1] + fy*t[3] + t[5];
-			gd = sqrtf(gx*gx + gy*gy);
-			c = cache->colors[(int)nsvg__clampf(gd*255.0f, 0, 255.0f)];
-			cr = (c) & 0xff;
-			cg = (c >> 8) & 0xff;
-			cb = (c >> 16) & 0xff;
-			ca = (c >> 24) & 0xff;
-
-			a = nsvg__div255((int)cover[0] * ca);
-			ia = 255 - a;
-
-			// Premultiply
-			r = nsvg__div255(cr * a);
-			g = nsvg__div255(cg * a);
-			b = nsvg__div255(cb * a);
-
-			// Blend over
-			r += nsvg__div255(ia * (int)dst[0]);
-			g += nsvg__div255(ia * (int)dst[1]);
-			b += nsvg__div255(ia * (int)dst[2]);
-			a += nsvg__div255(ia * (int)dst[3]);
+// Reference implementations of span compositing, the SIMD versions must match them exactly.
+static void nsvg__blendColor(unsigned char* dst, int count, unsigned char* cover, unsigned int color)
+{
+	int i;
+	for (i = 0; i < count; i++)
+		nsvg__blendPixel(&dst[i*4], cover[i], color);
+}
 
-			dst[0] = (unsigned char)r;
-			dst[1] = (unsigned char)g;
-			dst[2] = (unsigned char)b;
-			dst[3] = (unsigned char)a;
+static void nsvg__blendColors(unsigned char* dst, int count, unsigned char* cover, unsigned int* colors)
+{
+	int i;
+	for (i = 0; i < count; i++)
+		nsvg__blendPixel(&dst[i*4], cover[i], colors[i]);
+}
 
-			cover++;
-			dst += 4;
-			fx += dx;
+// Looks up the gradient colors of pixels i..count-1 of a span starting at x. The gradient space
+// position of pixel i is (gx + (x+i)*dx, gy + (x+i)*dy), linear gradients use its y coordinate and
+// radial gradients its distance from the origin. Stepping from the start of the row keeps the
+// result independent of how the row is split into spans. Returns the number of pixels done, the
+// SIMD versions stop at the last full vector and compute each pixel exactly like this one.
+static int nsvg__gradientColors(unsigned int* colors, int i, int count, int x, int radial,
+								float gx, float gy, float dx, float dy, unsigned int* lut)
+{
+	for (; i < count; i++) {
+		float u = gy + (float)(x+i)*dy;
+		if (radial) {
+			float v = gx + (float)(x+i)*dx;
+			u = sqrtf(v*v + u*u);
 		}
+		colors[i] = lut[(int)nsvg__clampf(u*255.0f, 0, 255.0f)];
 	}
+	return i;
 }
 
-static void nsvg__rasterizeSortedEdges(NSVGrasterizer *r, float tx, float ty, float scale, NSVGcachedPaint* cache, char fillRule)
-{
-	NSVGactiveEdge *active = NULL;
-	int y, s;
-	int e = 0;
-	int maxWeight = (255 / NSVG__SUBSAMPLES);  // weight per vertical scanline
-	int xmin, xmax;
-
-	for (y = 0; y < r->height; y++) {
-		memset(r->scanline, 0, r->width);
-		xmin = r->width;
-		xmax = 0;
-		for (s = 0; s < NSVG__SUBSAMPLES; ++s) {
-			// find center of pixel for this scanline
-			float scany = (float)(y*NSVG__SUBSAMPLES + s) + 0.5f;
-			NSVGactiveEdge **step = &active;
-
-			// update all active edges;
-			// remove all active edges that terminate before the center of this scanline
-			while (*step) {
-				NSVGactiveEdge *z = *step;
-				if (z->ey <= scany) {
-					*step = z->next; // delete from list
-//					NSVG__assert(z->valid);
-					nsvg__freeActive(r, z);
-				} else {
-					z->x += z->dx; // advance to position for current scanline
-					step = &((*step)->next); // advance through list
-				}
-			}
-
-			// resort the list if needed
-			for (;;) {
-				int changed = 0;
-				step = &active;
-				while (*step && (*step)->next) {
-					if ((*step)->x > (*step)->next->x) {
-						NSVGactiveEdge* t = *step;
-						NSVGactiveEdge* q = t->next;
-						t->next = q->next;
-						q->next = t;
-						*step = q;
-						changed = 1;
-					}
-					step = &(*step)->next;
-				}
-				if (!changed) break;
-			}
+// The SIMD kernels work on 16-bit lanes. All products are at most 255*255, and for those
+// ((x+1)*257)>>16 is the high half of a 16-bit multiply, which makes them match nsvg__div255() exactly.
+// The color is blended with 255 in place of its alpha, premultiplying it by the coverage alpha
+// yields the alpha itself. Each kernel returns the number of pixels it processed.
 
-			// insert all edges that start before the center of this scanline -- omit ones that also end on this scanline
-			while (e < r->nedges && r->edges[e].y0 <= scany) {
-				if (r->edges[e].y1 > scany) {
-					NSVGactiveEdge* z = nsvg__addActive(r, &r->edges[e], scany);
-					if (z == NULL) break;
-					// find insertion point
-					if (active == NULL) {
-						active = z;
-					} else if (z->x < active->x) {
-						// insert at front
-						z->next = active;
-						active = z;
-					} else {
-						// find thing to insert AFTER
-						NSVGactiveEdge* p = active;
-						while (p->next && p->next->x < z->x)
-							p = p->next;
-						// at this point, p->next->x is NOT < z->x
-						z->next = p->next;
-						p->next = z;
-					}
-				}
-				e++;
-			}
+#ifdef NSVG__SSE2
+static inline __m128i nsvg__div255SSE2(__m128i x)
+{
+	return _mm_mulhi_epu16(_mm_add_epi16(x, _mm_set1_epi16(1)), _mm_set1_epi16(257));
+}
 
-			// now process all active edges in non-zero fashion
-			if (active != NULL)
-				nsvg__fillActiveEdges(r->scanline, r->width, active, maxWeight, &xmin, &xmax, fillRule);
-		}
-		// Blit
-		if (xmin < 0) xmin = 0;
-		if (xmax > r->width-1) xmax = r->width-1;
-		if (xmin <= xmax) {
-			nsvg__scanlineSolid(&r->bitmap[y * r->stride] + xmin*4, xmax-xmin+1, &r->scanline[xmin], xmin, y, tx,ty, scale, cache);
-		}
-	}
+// Blends two pixels: src and dst hold 2 RGBA pixels, a holds alpha of each pixel in all four channels.
+static inline __m128i nsvg__blendSSE2(__m128i src, __m128i dst, __m128i a)
+{
+	__m128i ia = _mm_sub_epi16(_mm_set1_epi16(255), a);
+	return _mm_add_epi16(nsvg__div255SSE2(_mm_mullo_epi16(src, a)), nsvg__div255SSE2(_mm_mullo_epi16(dst, ia)));
+}
 
+// Blends four pixels of color c (with alpha set to 255), a holds the alpha of each pixel in the low
+// four lanes.
+static inline void nsvg__blend4SSE2(unsigned char* dst, __m128i c, __m128i a)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i alo, ahi, d;
+	a = _mm_unpacklo_epi16(a, a);
+	alo = _mm_unpacklo_epi32(a, a);
+	ahi = _mm_unpackhi_epi32(a, a);
+	d = _mm_loadu_si128((__m128i*)dst);
+	d = _mm_packus_epi16(nsvg__blendSSE2(_mm_unpacklo_epi8(c, zero), _mm_unpacklo_epi8(d, zero), alo),
+						 nsvg__blendSSE2(_mm_unpackhi_epi8(c, zero), _mm_unpackhi_epi8(d, zero), ahi));
+	_mm_storeu_si128((__m128i*)dst, d);
 }
 
-static void nsvg__unpremultiplyAlpha(unsigned char* image, int w, int h, int stride)
+static inline __m128i nsvg__loadCover4SSE2(unsigned char* cover)
 {
-	int x,y;
+	int cov;
+	memcpy(&cov, cover, 4);
+	return _mm_unpacklo_epi8(_mm_cvtsi32_si128(cov), _mm_setzero_si128());
+}
 
-	// Unpremultiply
-	for (y = 0; y < h; y++) {
-		unsigned char *row = &image[y*stride];
-		for (x = 0; x < w; x++) {
-			int r = row[0], g = row[1], b = row[2], a = row[3];
-			if (a != 0) {
-				row[0] = (unsigned char)(r*255/a);
-				row[1] = (unsigned char)(g*255/a);
-				row[2] = (unsigned char)(b*255/a);
+static int nsvg__blendColorSSE2(unsigned char* dst, int count, unsigned char* cover, unsigned int color)
+{
+	__m128i c = _mm_set1_epi32((int)(color | 0xff000000u));
+	__m128i ca = _mm_set1_epi16((short)(color >> 24));
+	int i;
+
+	for (i = 0; i+4 <= count; i += 4)
+		nsvg__blend4SSE2(&dst[i*4], c, nsvg__div255SSE2(_mm_mullo_epi16(nsvg__loadCover4SSE2(&cover[i]), ca)));
+
+	return i;
+}
+
+static int nsvg__blendColorsSSE2(unsigned char* dst, int count, unsigned char* cover, unsigned int* colors)
+{
+	const __m128i amask = _mm_set1_epi32((int)0xff000000u);
+	int i;
+
+	for (i = 0; i+4 <= count; i += 4) {
+		__m128i c = _mm_loadu_si128((__m128i*)&colors[i]);
+		__m128i ca = _mm_packs_epi32(_mm_srli_epi32(c, 24), _mm_setzero_si128());
+		nsvg__blend4SSE2(&dst[i*4], _mm_or_si128(c, amask),
+						 nsvg__div255SSE2(_mm_mullo_epi16(nsvg__loadCover4SSE2(&cover[i]), ca)));
+	}
+
+	return i;
+}
+
+static int nsvg__gradientColorsSSE2(unsigned int* colors, int i, int count, int x, int radial,
+									float gx, float gy, float dx, float dy, unsigned int* lut)
+{
+	const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(255.0f);
+	__m128 vgx = _mm_set1_ps(gx), vgy = _mm_set1_ps(gy), vdx = _mm_set1_ps(dx), vdy = _mm_set1_ps(dy);
+	__m128 vi = _mm_add_ps(_mm_set1_ps((float)(x+i)), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f));
+	int idx[4];
+
+	for (; i+4 <= count; i += 4) {
+		__m128 u = _mm_add_ps(vgy, _mm_mul_ps(vi, vdy));
+		if (radial) {
+			__m128 v = _mm_add_ps(vgx, _mm_mul_ps(vi, vdx));
+			u = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(v, v), _mm_mul_ps(u, u)));
+		}
+		// max() returns zero for NaN
+		u = _mm_min_ps(_mm_max_ps(_mm_mul_ps(u, one), zero), one);
+		_mm_storeu_si128((__m128i*)idx, _mm_cvttps_epi32(u));
+		colors[i+0] = lut[idx[0]];
+		colors[i+1] = lut[idx[1]];
+		colors[i+2] = lut[idx[2]];
+		colors[i+3] = lut[idx[3]];
+		vi = _mm_add_ps(vi, _mm_set1_ps(4.0f));
+	}
+
+	return i;
+}
+#endif
+
+#ifdef NSVG__AVX2
+static NSVG__TARGET_AVX2 inline __m256i nsvg__div255AVX2(__m256i x)
+{
+	return _mm256_mulhi_epu16(_mm256_add_epi16(x, _mm256_set1_epi16(1)), _mm256_set1_epi16(257));
+}
+
+// Blends four pixels, see nsvg__blendSSE2().
+static NSVG__TARGET_AVX2 inline __m256i nsvg__blendAVX2(__m256i src, __m256i dst, __m256i a)
+{
+	__m256i ia = _mm256_sub_epi16(_mm256_set1_epi16(255), a);
+	return _mm256_add_epi16(nsvg__div255AVX2(_mm256_mullo_epi16(src, a)), nsvg__div255AVX2(_mm256_mullo_epi16(dst, ia)));
+}
+
+// Blends eight pixels of color c (with alpha set to 255), a holds the alpha of each pixel.
+// The unpacked halves of a 256-bit register hold pixels 0,1,4,5 (lo) and 2,3,6,7 (hi).
+static NSVG__TARGET_AVX2 inline void nsvg__blend8AVX2(unsigned char* dst, __m256i c, __m128i a)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m128i a03 = _mm_unpacklo_epi16(a, a);
+	__m128i a47 = _mm_unpackhi_epi16(a, a);
+	__m256i alo = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi32(a03, a03)), _mm_unpacklo_epi32(a47, a47), 1);
+	__m256i ahi = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpackhi_epi32(a03, a03)), _mm_unpackhi_epi32(a47, a47), 1);
+	__m256i d = _mm256_loadu_si256((__m256i*)dst);
+	d = _mm256_packus_epi16(nsvg__blendAVX2(_mm256_unpacklo_epi8(c, zero), _mm256_unpacklo_epi8(d, zero), alo),
+							nsvg__blendAVX2(_mm256_unpackhi_epi8(c, zero), _mm256_unpackhi_epi8(d, zero), ahi));
+	_mm256_storeu_si256((__m256i*)dst, d);
+}
+
+static NSVG__TARGET_AVX2 inline __m128i nsvg__coverAlpha8AVX2(unsigned char* cover, __m128i ca)
+{
+	__m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i*)cover), _mm_setzero_si128());
+	return _mm_mulhi_epu16(_mm_add_epi16(_mm_mullo_epi16(a, ca), _mm_set1_epi16(1)), _mm_set1_epi16(257));
+}
+
+static NSVG__TARGET_AVX2 int nsvg__blendColorAVX2(unsigned char* dst, int count, unsigned char* cover, unsigned int color)
+{
+	__m256i c = _mm256_set1_epi32((int)(color | 0xff000000u));
+	__m128i ca = _mm_set1_epi16((short)(color >> 24));
+	int i;
+
+	for (i = 0; i+8 <= count; i += 8)
+		nsvg__blend8AVX2(&dst[i*4], c, nsvg__coverAlpha8AVX2(&cover[i], ca));
+
+	return i;
+}
+
+static NSVG__TARGET_AVX2 int nsvg__blendColorsAVX2(unsigned char* dst, int count, unsigned char* cover, unsigned int* colors)
+{
+	const __m256i amask = _mm256_set1_epi32((int)0xff000000u);
+	int i;
+
+	for (i = 0; i+8 <= count; i += 8) {
+		__m256i c = _mm256_loadu_si256((__m256i*)&colors[i]);
+		__m256i ca = _mm256_srli_epi32(c, 24);
+		nsvg__blend8AVX2(&dst[i*4], _mm256_or_si256(c, amask),
+						 nsvg__coverAlpha8AVX2(&cover[i], _mm_packs_epi32(_mm256_castsi256_si128(ca), _mm256_extracti128_si256(ca, 1))));
+	}
+
+	return i;
+}
+
+static NSVG__TARGET_AVX2 int nsvg__gradientColorsAVX2(unsigned int* colors, int i, int count, int x, int radial,
+													  float gx, float gy, float dx, float dy, unsigned int* lut)
+{
+	const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(255.0f);
+	__m256 vgx = _mm256_set1_ps(gx), vgy = _mm256_set1_ps(gy), vdx = _mm256_set1_ps(dx), vdy = _mm256_set1_ps(dy);
+	__m256 vi = _mm256_add_ps(_mm256_set1_ps((float)(x+i)), _mm256_set_ps(7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f));
+
+	for (; i+8 <= count; i += 8) {
+		__m256 u = _mm256_add_ps(vgy, _mm256_mul_ps(vi, vdy));
+		if (radial) {
+			__m256 v = _mm256_add_ps(vgx, _mm256_mul_ps(vi, vdx));
+			u = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(v, v), _mm256_mul_ps(u, u)));
+		}
+		// max() returns zero for NaN
+		u = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(u, one), zero), one);
+		_mm256_storeu_si256((__m256i*)&colors[i], _mm256_i32gather_epi32((const int*)lut, _mm256_cvttps_epi32(u), 4));
+		vi = _mm256_add_ps(vi, _mm256_set1_ps(8.0f));
+	}
+
+	return i;
+}
+#endif
+
+// Looks up gradient colors of count pixels starting at x,y.
+static void nsvg__gradientSpan(unsigned int* colors, int count, int x, int y, NSVGcachedPaint* cache, int simd)
+{
+	// TODO: spread modes.
+	// TODO: focus (fx,fy)
+	// The gradient transform is in pixel space, step it along the row.
+	int radial = cache->type == NSVG_PAINT_RADIAL_GRADIENT;
+	float* t = cache->xform;
+	float gx = (float)y*t[2] + t[4];
+	float gy = (float)y*t[3] + t[5];
+	int i = 0;
+	(void)simd;
+#ifdef NSVG__AVX2
+	if (simd >= NSVG__SIMD_AVX2)
+		i = nsvg__gradientColorsAVX2(colors, i, count, x, radial, gx, gy, t[0], t[1], cache->colors);
+#endif
+#ifdef NSVG__SSE2
+	if (simd >= NSVG__SIMD_SSE2)
+		i = nsvg__gradientColorsSSE2(colors, i, count, x, radial, gx, gy, t[0], t[1], cache->colors);
+#endif
+	nsvg__gradientColors(colors, i, count, x, radial, gx, gy, t[0], t[1], cache->colors);
+}
+
+// Composites an antialiased span.
+static void nsvg__blendSpan(unsigned char* dst, int count, unsigned char* cover, int x, int y,
+							NSVGcachedPaint* cache, int simd)
+{
+	(void)simd;
+
+	if (cache->type == NSVG_PAINT_COLOR) {
+		int n = 0;
+#ifdef NSVG__AVX2
+		if (simd >= NSVG__SIMD_AVX2)
+			n = nsvg__blendColorAVX2(dst, count, cover, cache->colors[0]);
+#endif
+#ifdef NSVG__SSE2
+		if (simd >= NSVG__SIMD_SSE2)
+			n += nsvg__blendColorSSE2(&dst[n*4], count-n, &cover[n], cache->colors[0]);
+#endif
+		// Remaining pixels
+		nsvg__blendColor(&dst[n*4], count-n, &cover[n], cache->colors[0]);
+	} else {
+		unsigned int colors[NSVG__GRADIENT_SPAN];
+		int i, j, n;
+
+		for (i = 0; i < count; i += n) {
+			n = count - i < NSVG__GRADIENT_SPAN ? count - i : NSVG__GRADIENT_SPAN;
+			nsvg__gradientSpan(colors, n, x + i, y, cache, simd);
+
+			j = 0;
+#ifdef NSVG__AVX2
+			if (simd >= NSVG__SIMD_AVX2)
+				j = nsvg__blendColorsAVX2(&dst[i*4], n, &cover[i], colors);
+#endif
+#ifdef NSVG__SSE2
+			if (simd >= NSVG__SIMD_SSE2)
+				j += nsvg__blendColorsSSE2(&dst[(i+j)*4], n-j, &cover[i+j], &colors[j]);
+#endif
+			nsvg__blendColors(&dst[(i+j)*4], n-j, &cover[i+j], &colors[j]);
+		}
+	}
+}
+
+static void nsvg__storeColor(unsigned char* dst, unsigned int c)
+{
+	dst[0] = (unsigned char)(c & 0xff);
+	dst[1] = (unsigned char)((c >> 8) & 0xff);
+	dst[2] = (unsigned char)((c >> 16) & 0xff);
+	dst[3] = (unsigned char)((c >> 24) & 0xff);
+}
+
+// Writes a fully covered span of opaque paint, blending would just return the paint color.
+static void nsvg__fillSpan(unsigned char* dst, int count, int x, int y, NSVGcachedPaint* cache, int simd)
+{
+	int i = 0;
+
+	if (cache->type == NSVG_PAINT_COLOR) {
+		unsigned int c = cache->colors[0];
+#ifdef NSVG__SSE2
+		__m128i c4 = _mm_set1_epi32((int)c);
+		for (; i+4 <= count; i += 4)
+			_mm_storeu_si128((__m128i*)&dst[i*4], c4);
+#endif
+		for (; i < count; i++)
+			nsvg__storeColor(&dst[i*4], c);
+	} else {
+		unsigned int colors[NSVG__GRADIENT_SPAN];
+		int j, n;
+
+		for (i = 0; i < count; i += n) {
+			n = count - i < NSVG__GRADIENT_SPAN ? count - i : NSVG__GRADIENT_SPAN;
+			nsvg__gradientSpan(colors, n, x + i, y, cache, simd);
+			for (j = 0; j < n; j++)
+				nsvg__storeColor(&dst[(i+j)*4], colors[j]);
+		}
+	}
+}
+
+// Returns the number of leading coverage values equal to v.
+static int nsvg__coverRun(unsigned char* cover, int count, unsigned char v)
+{
+	unsigned int w = v * 0x01010101u, c;
+	int i = 0;
+	while (i+4 <= count) {
+		memcpy(&c, &cover[i], 4);
+		if (c != w) break;
+		i += 4;
+	}
+	while (i < count && cover[i] == v)
+		i++;
+	return i;
+}
+
+static void nsvg__scanlineSolid(unsigned char* dst, int count, unsigned char* cover, int x, int y,
+								NSVGcachedPaint* cache, int simd)
+{
+	int i, n;
+
+	// Split the coverage into runs: empty runs are skipped, fully covered runs of opaque paint
+	// are stored directly and only the rest goes through blending.
+	for (i = 0; i < count; i += n) {
+		if (cover[i] == 0) {
+			n = nsvg__coverRun(&cover[i], count-i, 0);
+		} else if (cover[i] == 255 && cache->opaque) {
+			n = nsvg__coverRun(&cover[i], count-i, 255);
+			nsvg__fillSpan(&dst[i*4], n, x+i, y, cache, simd);
+		} else {
+			n = 1;
+			while (i+n < count && cover[i+n] != 0 && !(cover[i+n] == 255 && cache->opaque))
+				n++;
+			nsvg__blendSpan(&dst[i*4], n, &cover[i], x+i, y, cache, simd);
+		}
+	}
+}
+
+// Span writers for the formats other than RGBA and BGRA. They take the destination row and the
+// position of the span in it, so that spans can start in the middle of a byte of a 1 bit mask.
+
+// Fills colors with the paint of up to NSVG__GRADIENT_SPAN pixels, returns the number of pixels.
+static int nsvg__paintSpan(unsigned int* colors, int count, int x, int y, NSVGcachedPaint* cache, int simd)
+{
+	int i, n = count < NSVG__GRADIENT_SPAN ? count : NSVG__GRADIENT_SPAN;
+	if (cache->type == NSVG_PAINT_COLOR) {
+		for (i = 0; i < n; i++)
+			colors[i] = cache->colors[0];
+	} else {
+		nsvg__gradientSpan(colors, n, x, y, cache, simd);
+	}
+	return n;
+}
+
+static void nsvg__fillSpanA8(unsigned char* row, int px, int count)
+{
+	memset(&row[px], 255, count);
+}
+
+static void nsvg__blendSpanA8(unsigned char* row, int px, int count, unsigned char* cover, int x, int y,
+							  NSVGcachedPaint* cache, int simd)
+{
+	unsigned int colors[NSVG__GRADIENT_SPAN];
+	unsigned char* dst;
+	int i, j, n, a;
+
+	for (i = 0; i < count; i += n) {
+		n = nsvg__paintSpan(colors, count - i, x + i, y, cache, simd);
+		dst = &row[px + i];
+		for (j = 0; j < n; j++) {
+			// Same as the alpha channel of nsvg__blendPixel().
+			a = nsvg__div255(cover[i+j] * (int)(colors[j] >> 24));
+			dst[j] = (unsigned char)(a + nsvg__div255((255 - a) * (int)dst[j]));
+		}
+	}
+}
+
+static unsigned short nsvg__packRGB565(int r, int g, int b)
+{
+	// Rounds 8 bit channels to 5 and 6 bits.
+	return (unsigned short)((((r * 249 + 1014) >> 11) << 11) | (((g * 253 + 505) >> 10) << 5) | ((b * 249 + 1014) >> 11));
+}
+
+static void nsvg__fillSpanRGB565(unsigned char* row, int px, int count, int x, int y, NSVGcachedPaint* cache, int simd)
+{
+	unsigned int colors[NSVG__GRADIENT_SPAN];
+	unsigned short v;
+	int i, j, n;
+
+	for (i = 0; i < count; i += n) {
+		n = nsvg__paintSpan(colors, count - i, x + i, y, cache, simd);
+		for (j = 0; j < n; j++) {
+			v = nsvg__packRGB565(colors[j] & 0xff, (colors[j] >> 8) & 0xff, (colors[j] >> 16) & 0xff);
+			memcpy(&row[(px + i + j) * 2], &v, 2);
+		}
+	}
+}
+
+static void nsvg__blendSpanRGB565(unsigned char* row, int px, int count, unsigned char* cover, int x, int y,
+								  NSVGcachedPaint* cache, int simd)
+{
+	unsigned int colors[NSVG__GRADIENT_SPAN];
+	unsigned short v;
+	unsigned int c;
+	int i, j, n, a, ia, r, g, b;
+
+	for (i = 0; i < count; i += n) {
+		n = nsvg__paintSpan(colors, count - i, x + i, y, cache, simd);
+		for (j = 0; j < n; j++) {
+			c = colors[j];
+			a = nsvg__div255(cover[i+j] * (int)(c >> 24));
+			ia = 255 - a;
+			memcpy(&v, &row[(px + i + j) * 2], 2);
+			// Expand the destination to 8 bits per channel and blend like nsvg__blendPixel().
+			r = (v >> 11) & 0x1f;
+			g = (v >> 5) & 0x3f;
+			b = v & 0x1f;
+			r = nsvg__div255((int)(c & 0xff) * a) + nsvg__div255(ia * ((r << 3) | (r >> 2)));
+			g = nsvg__div255((int)((c >> 8) & 0xff) * a) + nsvg__div255(ia * ((g << 2) | (g >> 4)));
+			b = nsvg__div255((int)((c >> 16) & 0xff) * a) + nsvg__div255(ia * ((b << 3) | (b >> 2)));
+			v = nsvg__packRGB565(r, g, b);
+			memcpy(&row[(px + i + j) * 2], &v, 2);
+		}
+	}
+}
+
+// Sets or clears count bits of a mask row starting at pixel px.
+static void nsvg__fillSpanMask1(unsigned char* row, int px, int count, int set)
+{
+	int x0 = px, x1 = px + count;
+
+	// Partial bytes at both ends, whole bytes in between.
+	for (; x0 < x1 && (x0 & 7) != 0; x0++) {
+		if (set) row[x0 >> 3] |= (unsigned char)(0x80 >> (x0 & 7));
+		else row[x0 >> 3] &= (unsigned char)~(0x80 >> (x0 & 7));
+	}
+	if (x1 - x0 >= 8) {
+		memset(&row[x0 >> 3], set ? 0xff : 0, (x1 - x0) >> 3);
+		x0 += (x1 - x0) & ~7;
+	}
+	for (; x0 < x1; x0++) {
+		if (set) row[x0 >> 3] |= (unsigned char)(0x80 >> (x0 & 7));
+		else row[x0 >> 3] &= (unsigned char)~(0x80 >> (x0 & 7));
+	}
+}
+
+static void nsvg__blendSpanMask1(unsigned char* row, int px, int count, unsigned char* cover, int x, int y,
+								 NSVGcachedPaint* cache, int simd)
+{
+	unsigned int colors[NSVG__GRADIENT_SPAN];
+	int i, j, n, k;
+
+	for (i = 0; i < count; i += n) {
+		n = nsvg__paintSpan(colors, count - i, x + i, y, cache, simd);
+		for (j = 0; j < n; j++) {
+			if (nsvg__div255(cover[i+j] * (int)(colors[j] >> 24)) >= 128) {
+				k = px + i + j;
+				row[k >> 3] |= (unsigned char)(0x80 >> (k & 7));
+			}
+		}
+	}
+}
+
+// Like nsvg__scanlineSolid() for the formats with their own span writers, see NSVGformat.
+static void nsvg__scanlineFormat(int format, unsigned char* row, int px, int count, unsigned char* cover, int x, int y,
+								 NSVGcachedPaint* cache, int simd)
+{
+	int i, n;
+
+	for (i = 0; i < count; i += n) {
+		if (cover[i] == 0) {
+			n = nsvg__coverRun(&cover[i], count-i, 0);
+		} else if (cover[i] == 255 && cache->opaque) {
+			n = nsvg__coverRun(&cover[i], count-i, 255);
+			if (format == NSVG_FORMAT_RGB565)
+				nsvg__fillSpanRGB565(row, px+i, n, x+i, y, cache, simd);
+			else if (format == NSVG_FORMAT_A8)
+				nsvg__fillSpanA8(row, px+i, n);
+			else
+				nsvg__fillSpanMask1(row, px+i, n, 1);
+		} else {
+			n = 1;
+			while (i+n < count && cover[i+n] != 0 && !(cover[i+n] == 255 && cache->opaque))
+				n++;
+			if (format == NSVG_FORMAT_RGB565)
+				nsvg__blendSpanRGB565(row, px+i, n, &cover[i], x+i, y, cache, simd);
+			else if (format == NSVG_FORMAT_A8)
+				nsvg__blendSpanA8(row, px+i, n, &cover[i], x+i, y, cache, simd);
+			else
+				nsvg__blendSpanMask1(row, px+i, n, &cover[i], x+i, y, cache, simd);
+		}
+	}
+}
+
+// Composites count pixels of coverage starting at pixel x of bitmap row y.
+static void nsvg__compositeSpan(NSVGrasterizer* r, int x, int y, int count, unsigned char* cover, NSVGcachedPaint* cache)
+{
+	unsigned char* row = &r->bitmap[y * r->stride];
+	if (r->format == NSVG_FORMAT_RGBA8 || r->format == NSVG_FORMAT_BGRA8)
+		nsvg__scanlineSolid(&row[x*4], count, cover, r->ox + x, r->oy + y, cache, r->simd);
+	else
+		nsvg__scanlineFormat(r->format, row, x, count, cover, r->ox + x, r->oy + y, cache, r->simd);
+}
+
+// Resolves the merged cells of row y into coverage and composites it. Consecutive cells are
+// blitted from the scanline buffer, the pixels between them have constant coverage.
+static void nsvg__blitCells(NSVGrasterizer* r, int y, NSVGcachedPaint* cache)
+{
+	unsigned char* dst = &r->bitmap[y * r->stride];
+	NSVGcell* cells = r->cells;
+	int i, n = r->ncells, acc = 0, x0, x;
+	int rgba = r->format == NSVG_FORMAT_RGBA8 || r->format == NSVG_FORMAT_BGRA8;
+
+	r->ncells = 0;
+
+	i = 0;
+	while (i < n) {
+		x0 = x = cells[i].x;
+		while (i < n && cells[i].x == x) {
+			acc += cells[i].delta;
+			r->scanline[x] = (unsigned char)(acc + cells[i].cover);
+			i++;
+			x++;
+		}
+		nsvg__compositeSpan(r, x0, y, x-x0, &r->scanline[x0], cache);
+		memset(&r->scanline[x0], 0, x-x0);
+
+		// Constant coverage up to the next cell.
+		x0 = x;
+		x = i < n ? cells[i].x : r->width;
+		if (acc != 0 && x > x0) {
+			if (acc == 255 && cache->opaque && rgba) {
+				nsvg__fillSpan(&dst[x0*4], x-x0, r->ox + x0, r->oy + y, cache, r->simd);
+			} else {
+				memset(&r->scanline[x0], acc, x-x0);
+				nsvg__compositeSpan(r, x0, y, x-x0, &r->scanline[x0], cache);
+				memset(&r->scanline[x0], 0, x-x0);
+			}
+		}
+	}
+}
+
+// Fraction of pixel column c to the right of a segment going from xa to xb (xa <= xb) over the full
+// height of the row, written so that it stays accurate for short segments.
+static float nsvg__areaRight(float c, float xa, float xb)
+{
+	float t0 = c + 1.0f - xa;
+	float t1 = c + 1.0f - xb;
+	float len = xb - xa;
+	if (t1 >= 1.0f) return 1.0f;
+	if (t0 <= 0.0f) return 0.0f;
+	if (t1 >= 0.0f)
+		return t0 <= 1.0f ? (t0 + t1) * 0.5f : 1.0f - (1.0f - t1) * (1.0f - t1) / (2.0f * len);
+	return t0 <= 1.0f ? t0 * t0 / (2.0f * len) : (t0 - 0.5f) / len;
+}
+
+// Accumulates an edge crossing a pixel row from xa to xb, covering h/NSVG__HEIGHT of its height.
+// The prefix sum of the row at a pixel is its coverage in units of 1/NSVG__AREA. Coverage is
+// rounded per pixel before taking differences, so the sum up to any pixel does not depend on
+// where the row starts, and parts left of the row are folded into its first pixel.
+static void nsvg__accumulateEdge(NSVGrasterizer* r, float xa, float xb, int h, int dir, int* xmin, int* xmax)
+{
+	int c, c0, c1, prev = 0, area;
+	int ox = r->ox, len = r->width;
+
+	if (xa > xb) {
+		float t = xa; xa = xb; xb = t;
+	}
+	if (xa >= (float)(ox + len)) {
+		// Coverage ends right of the row.
+		*xmax = len;
+		return;
+	}
+
+	c0 = xa <= (float)ox ? ox : (int)floorf(xa);
+	c1 = xb >= (float)(ox + len) ? ox + len : (int)floorf(xb) + 1;
+	if (c1 < c0) c1 = c0;
+	for (c = c0; c <= c1; c++) {
+		area = (int)(nsvg__areaRight((float)c, xa, xb) * (float)(h * NSVG__HEIGHT) + 0.5f);
+		r->accum[c - ox] += (area - prev) * dir;
+		prev = area;
+	}
+
+	if (c0 - ox < *xmin) *xmin = c0 - ox;
+	if (c1 - ox > *xmax) *xmax = c1 - ox;
+}
+
+static int nsvg__reserveAccum(NSVGrasterizer* r)
+{
+	if (r->caccum < r->width + 2) {
+		r->caccum = r->width + 2;
+		r->accum = (int*)realloc(r->accum, sizeof(int) * r->caccum);
+		if (r->accum == NULL) return 0;
+		memset(r->accum, 0, sizeof(int) * r->caccum);
+	}
+	return 1;
+}
+
+// Resolves the coverage of pixels xmin..xmax of the scanline from the winding accumulated along the row,
+// and clears the accumulator.
+static void nsvg__resolveCoverage(NSVGrasterizer* r, int xmin, int xmax, char fillRule)
+{
+	int i, acc = 0;
+	for (i = xmin; i <= xmax; i++) {
+		int c;
+		// Skip quickly over empty parts, the scanline is already cleared.
+		if (acc == 0) {
+			while (i+4 <= xmax && (r->accum[i] | r->accum[i+1] | r->accum[i+2] | r->accum[i+3]) == 0)
+				i += 4;
+		}
+		acc += r->accum[i];
+		r->accum[i] = 0;
+		c = acc < 0 ? -acc : acc;
+		if (fillRule == NSVG_FILLRULE_EVENODD) {
+			c &= 2*NSVG__AREA - 1;
+			if (c > NSVG__AREA) c = 2*NSVG__AREA - c;
+		} else if (c > NSVG__AREA) {
+			c = NSVG__AREA;
+		}
+		if (i < r->width)
+			r->scanline[i] = (unsigned char)((c * 255 + NSVG__AREA/2) >> NSVG__AREASHIFT);
+	}
+}
+
+// Rasterizes the sorted edges with exact area coverage, one pass per pixel row.
+static void nsvg__rasterizeAnalytic(NSVGrasterizer *r, NSVGcachedPaint* cache, char fillRule)
+{
+	int y, i, n, e = 0;
+	float firsty;
+
+	if (!nsvg__reserveAccum(r))
+		return;
+	if (r->caedges < r->nedges) {
+		r->caedges = r->nedges;
+		r->aedges = (int*)realloc(r->aedges, sizeof(int) * r->caedges);
+		if (r->aedges == NULL) return;
+	}
+	r->naedges = 0;
+
+	// Start from the row of the first edge.
+	firsty = nsvg__edgeTop(&r->edges[0]) / r->subsamples - (float)r->oy;
+	if (firsty >= (float)r->height)
+		return;
+	y = firsty > 0.0f ? (int)firsty : 0;
+
+	for (; y < r->height; y++) {
+		float top = (float)((r->oy + y) * r->subsamples);
+		float bottom = top + r->subsamples;
+		int xmin = r->width, xmax = 0;
+
+		if (r->naedges == 0) {
+			// Nothing left to draw, or skip the empty rows until the next edge.
+			float nexty;
+			if (e >= r->nedges)
+				break;
+			nexty = nsvg__edgeTop(&r->edges[e]) / r->subsamples - (float)r->oy;
+			if (nexty >= (float)r->height)
+				break;
+			if (nexty > (float)y + 1.0f) {
+				y = (int)nexty;
+				top = (float)((r->oy + y) * r->subsamples);
+				bottom = top + r->subsamples;
+			}
+		}
+
+		// Remove edges which ended above the row, and add the ones starting in it.
+		for (i = n = 0; i < r->naedges; i++)
+			if (nsvg__edgeBottom(&r->edges[r->aedges[i]]) > top)
+				r->aedges[n++] = r->aedges[i];
+		r->naedges = n;
+		while (e < r->nedges && nsvg__edgeTop(&r->edges[e]) < bottom) {
+			if (nsvg__edgeBottom(&r->edges[e]) > top)
+				r->aedges[r->naedges++] = e;
+			e++;
+		}
+
+		for (i = 0; i < r->naedges; i++) {
+			NSVGedge ed;
+			int dir = nsvg__orientEdge(&r->edges[r->aedges[i]], &ed);
+			float dxdy = (ed.x1 - ed.x0) / (ed.y1 - ed.y0);
+			float ya = ed.y0 > top ? ed.y0 : top;
+			float yb = ed.y1 < bottom ? ed.y1 : bottom;
+			float xa = ed.x0 + dxdy * (ya - ed.y0);
+			float xb = ed.x0 + dxdy * (yb - ed.y0);
+			// Heights are quantized relative to the row, so that they cancel exactly along a contour.
+			int h = (int)((yb - top) * ((float)NSVG__HEIGHT / r->subsamples) + 0.5f) -
+					(int)((ya - top) * ((float)NSVG__HEIGHT / r->subsamples) + 0.5f);
+			if (h != 0)
+				nsvg__accumulateEdge(r, xa, xb, h, dir, &xmin, &xmax);
+		}
+		if (xmin > xmax)
+			continue;
+
+		nsvg__resolveCoverage(r, xmin, xmax, fillRule);
+		if (xmax > r->width-1) xmax = r->width-1;
+		if (xmin <= xmax) {
+			nsvg__compositeSpan(r, xmin, y, xmax-xmin+1, &r->scanline[xmin], cache);
+			memset(&r->scanline[xmin], 0, xmax-xmin+1);
+		}
+	}
+}
+
+static void nsvg__rasterizeSortedEdges(NSVGrasterizer *r, NSVGcachedPaint* cache, char fillRule)
+{
+	int y, s;
+	int e = 0;
+	int maxWeight;
+	int xmin, xmax;
+	float firsty;
+
+	if (r->nedges == 0)
+		return;
+
+	if (r->coverage == NSVG_COVERAGE_ANALYTIC) {
+		nsvg__rasterizeAnalytic(r, cache, fillRule);
+		return;
+	}
+
+	// Start from the row of the first edge.
+	firsty = nsvg__edgeTop(&r->edges[0]) / r->subsamples - (float)r->oy;
+	if (firsty >= (float)r->height)
+		return;
+	y = firsty > 0.0f ? (int)firsty : 0;
+
+	if (!nsvg__reserveActive(r, r->nedges))
+		return;
+	r->active.nedges = 0;
+
+	// When rendering a band, pick up the edges which started above it.
+	if (y == 0 && r->oy > 0)
+		e = nsvg__primeActiveEdges(r, 0, r->oy * r->subsamples);
+
+	for (; y < r->height; y++) {
+		if (r->active.nedges == 0) {
+			// Nothing left to draw, or skip the empty rows until the next edge.
+			float nexty;
+			if (e >= r->nedges)
+				break;
+			nexty = nsvg__edgeTop(&r->edges[e]) / r->subsamples - (float)r->oy;
+			if (nexty >= (float)r->height)
+				break;
+			if (nexty > (float)y)
+				y = (int)nexty;
+		}
+		xmin = r->width;
+		xmax = 0;
+		for (s = 0; s < r->subsamples; ++s) {
+			// find center of pixel for this scanline
+			float scany = (float)((r->oy + y)*r->subsamples + s) + 0.5f;
+
+			// remove all active edges that terminate before the center of this scanline,
+			// advance the rest and resort them if needed
+			nsvg__stepActive(r, scany, s == 0);
+			nsvg__sortActive(r);
+
+			// insert all edges that start before the center of this scanline -- omit ones that also end on this scanline
+			while (e < r->nedges && nsvg__edgeTop(&r->edges[e]) <= scany) {
+				if (nsvg__edgeBottom(&r->edges[e]) > scany) {
+					nsvg__addActive(r, &r->edges[e], scany, 0);
+				}
+				e++;
+			}
+
+			// now process all active edges in non-zero fashion
+			if (r->active.nedges != 0) {
+				int first = r->ncells;
+				// Weights of the sub-scanlines add up to 255, so the coverage fits in a byte.
+				maxWeight = 255 * (s+1) / r->subsamples - 255 * s / r->subsamples;
+				nsvg__fillActiveEdges(r, maxWeight, &xmin, &xmax, fillRule);
+				if (r->coverage == NSVG_COVERAGE_CELLS && r->ncells > first)
+					nsvg__mergeCells(r, first);
+			}
+		}
+		// Blit
+		if (r->coverage == NSVG_COVERAGE_CELLS) {
+			nsvg__blitCells(r, y, cache);
+			continue;
+		}
+		if (xmin < 0) xmin = 0;
+		if (xmax > r->width-1) xmax = r->width-1;
+		if (xmin <= xmax) {
+			nsvg__compositeSpan(r, xmin, y, xmax-xmin+1, &r->scanline[xmin], cache);
+			// Only the blitted range has been touched, leave the scanline cleared for the next row.
+			memset(&r->scanline[xmin], 0, xmax-xmin+1);
+		}
+	}
+
+}
+
+// Fills a rectangle found by nsvg__placeRect() without building edges. Each row gets the coverage that
+// the two vertical edges of the rectangle would give in the current coverage mode, so the output is the
+// same. The rows between the top and bottom edges all have the same coverage, it is computed once.
+static void nsvg__rasterizeRect(NSVGrasterizer* r, NSVGcachedPaint* cache, const float* rect, char fillRule)
+{
+	float x0 = rect[0], y0 = rect[1], x1 = rect[2], y1 = rect[3];
+	float fy0 = y0 / r->subsamples - (float)r->oy, fy1 = y1 / r->subsamples - (float)r->oy;
+	int offset = r->ox * NSVG__FIX;
+	int ix0 = (int)nsvg__roundf(NSVG__FIX * x0) - offset;
+	int ix1 = (int)nsvg__roundf(NSVG__FIX * x1) - offset;
+	int y, ystart, yend, s, full = 0, fxmin = 0, fxmax = 0;
+
+	if (r->coverage == NSVG_COVERAGE_ANALYTIC && !nsvg__reserveAccum(r))
+		return;
+
+	if (fy1 < 0.0f || fy0 >= (float)r->height)
+		return;
+	ystart = fy0 > 0.0f ? (int)fy0 : 0;
+	yend = fy1 < (float)r->height ? (int)fy1 + 1 : r->height;
+
+	for (y = ystart; y < yend; y++) {
+		float top = (float)((r->oy + y) * r->subsamples);
+		int xmin = r->width, xmax = 0, inside;
+
+		if (r->coverage == NSVG_COVERAGE_ANALYTIC)
+			inside = y0 <= top && y1 >= top + r->subsamples;
+		else
+			inside = y0 <= top + 0.5f && (float)((r->oy + y)*r->subsamples + r->subsamples-1) + 0.5f < y1;
+		if (full && !inside) {
+			// Past the last full row.
+			memset(&r->scanline[fxmin], 0, fxmax-fxmin+1);
+			full = 0;
+		}
+
+		if (full) {
+			xmin = fxmin;
+			xmax = fxmax;
+		} else if (r->coverage == NSVG_COVERAGE_ANALYTIC) {
+			float bottom = top + r->subsamples;
+			float ya = y0 > top ? y0 : top;
+			float yb = y1 < bottom ? y1 : bottom;
+			int h;
+			if (y1 <= top || y0 >= bottom)
+				continue;
+			h = (int)((yb - top) * ((float)NSVG__HEIGHT / r->subsamples) + 0.5f) -
+				(int)((ya - top) * ((float)NSVG__HEIGHT / r->subsamples) + 0.5f);
+			if (h == 0)
+				continue;
+			nsvg__accumulateEdge(r, x0, x0, h, 1, &xmin, &xmax);
+			nsvg__accumulateEdge(r, x1, x1, h, -1, &xmin, &xmax);
+			if (xmin > xmax)
+				continue;
+			nsvg__resolveCoverage(r, xmin, xmax, fillRule);
+			if (xmax > r->width-1) xmax = r->width-1;
+		} else {
+			for (s = 0; s < r->subsamples; ++s) {
+				float scany = (float)((r->oy + y)*r->subsamples + s) + 0.5f;
+				if (y0 <= scany && scany < y1) {
+					int maxWeight = 255 * (s+1) / r->subsamples - 255 * s / r->subsamples;
+					nsvg__fillScanline(r->scanline, r->width, ix0, ix1, maxWeight, &xmin, &xmax);
+				}
+			}
+			if (xmin < 0) xmin = 0;
+			if (xmax > r->width-1) xmax = r->width-1;
+		}
+
+		if (xmin <= xmax) {
+			nsvg__compositeSpan(r, xmin, y, xmax-xmin+1, &r->scanline[xmin], cache);
+			if (inside && !full) {
+				// Keep the coverage for the following rows.
+				full = 1;
+				fxmin = xmin;
+				fxmax = xmax;
+			} else if (!inside) {
+				memset(&r->scanline[xmin], 0, xmax-xmin+1);
+			}
+		}
+	}
+	if (full)
+		memset(&r->scanline[fxmin], 0, fxmax-fxmin+1);
+}
+
+static void nsvg__unpremultiplyRow(unsigned char* row, int w, const float* inv)
+{
+	int x = 0;
+
+#ifdef NSVG__SSE2
+	{
+		__m128i zero = _mm_setzero_si128();
+		__m128i mask = _mm_set1_epi32(0xff);
+		for (; x+4 <= w; x += 4, row += 16) {
+			__m128i p = _mm_loadu_si128((__m128i*)row);
+			__m128i alpha = _mm_srli_epi32(p, 24);
+			__m128i lo, hi, q0, q1, q2, q3;
+			// Opaque and transparent pixels stay the same.
+			if ((_mm_movemask_epi8(_mm_cmpeq_epi32(alpha, mask)) | _mm_movemask_epi8(_mm_cmpeq_epi32(alpha, zero))) == 0xffff)
+				continue;
+			lo = _mm_unpacklo_epi8(p, zero);
+			hi = _mm_unpackhi_epi8(p, zero);
+			q0 = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), _mm_set_ps(1.0f, inv[row[3]], inv[row[3]], inv[row[3]])));
+			q1 = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), _mm_set_ps(1.0f, inv[row[7]], inv[row[7]], inv[row[7]])));
+			q2 = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), _mm_set_ps(1.0f, inv[row[11]], inv[row[11]], inv[row[11]])));
+			q3 = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), _mm_set_ps(1.0f, inv[row[15]], inv[row[15]], inv[row[15]])));
+			// Colors brighter than alpha wrap around like in the scalar code.
+			q0 = _mm_packs_epi32(_mm_and_si128(q0, mask), _mm_and_si128(q1, mask));
+			q2 = _mm_packs_epi32(_mm_and_si128(q2, mask), _mm_and_si128(q3, mask));
+			_mm_storeu_si128((__m128i*)row, _mm_packus_epi16(q0, q2));
+		}
+	}
+#endif
+
+	for (; x < w; x++, row += 4) {
+		int a = row[3];
+		if (a != 0 && a != 255) {
+			float m = inv[a];
+			row[0] = (unsigned char)((int)((float)row[0] * m) & 0xff);
+			row[1] = (unsigned char)((int)((float)row[1] * m) & 0xff);
+			row[2] = (unsigned char)((int)((float)row[2] * m) & 0xff);
+		}
+	}
+}
+
+static void nsvg__defringePixel(unsigned char* row, int x, int y, int w, int h, int stride)
+{
+	int r = 0, g = 0, b = 0, n = 0;
+	if (x-1 > 0 && row[-1] != 0) {
+		r += row[-4];
+		g += row[-3];
+		b += row[-2];
+		n++;
+	}
+	if (x+1 < w && row[7] != 0) {
+		r += row[4];
+		g += row[5];
+		b += row[6];
+		n++;
+	}
+	if (y-1 > 0 && row[-stride+3] != 0) {
+		r += row[-stride];
+		g += row[-stride+1];
+		b += row[-stride+2];
+		n++;
+	}
+	if (y+1 < h && row[stride+3] != 0) {
+		r += row[stride];
+		g += row[stride+1];
+		b += row[stride+2];
+		n++;
+	}
+	if (n > 0) {
+		row[0] = (unsigned char)(r/n);
+		row[1] = (unsigned char)(g/n);
+		row[2] = (unsigned char)(b/n);
+	}
+}
+
+// Gives transparent pixels the average color of their visible neighbours, so that filtering the image
+// does not bleed black into the edges. Reads the rows next to y, which must be unpremultiplied already.
+static void nsvg__defringeRow(unsigned char* image, int w, int h, int y, int stride)
+{
+	unsigned char* row = &image[y*stride];
+	int x = 0;
+
+#ifdef NSVG__SSE2
+	{
+		__m128i zero = _mm_setzero_si128();
+		__m128i amask = _mm_set1_epi32((int)0xff000000);
+		__m128i up = zero, down = zero;
+		for (; x+4 <= w; x += 4, row += 16) {
+			int empty = _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(_mm_loadu_si128((__m128i*)row), amask), zero));
+			int i;
+			// Groups of visible pixels are left as they are, and so are transparent ones with no visible neighbours.
+			if (empty == 0)
+				continue;
+			if (empty == 0xffff) {
+				if (y-1 > 0) up = _mm_loadu_si128((__m128i*)(row - stride));
+				if (y+1 < h) down = _mm_loadu_si128((__m128i*)(row + stride));
+				if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(_mm_or_si128(up, down), amask), zero)) == 0xffff &&
+					!(x-1 > 0 && row[-1] != 0) && !(x+4 < w && row[19] != 0))
+					continue;
+			}
+			for (i = 0; i < 4; i++) {
+				if (row[i*4+3] == 0)
+					nsvg__defringePixel(&row[i*4], x+i, y, w, h, stride);
+			}
+		}
+	}
+#endif
+
+	for (; x < w; x++, row += 4) {
+		if (row[3] == 0)
+			nsvg__defringePixel(row, x, y, w, h, stride);
+	}
+}
+
+// Unpremultiplies rows y0..y1 and defringes each of them as soon as its neighbours are done, while they
+// are still in cache. The first and last rows are defringed only when at the edge of the image, otherwise
+// they need rows outside the range, see nsvg__defringeEdgeRows().
+static void nsvg__unpremultiplyRows(unsigned char* image, int w, int h, int y0, int y1, int stride, const float* inv)
+{
+	int y;
+
+	if (y0 >= y1)
+		return;
+	nsvg__unpremultiplyRow(&image[y0*stride], w, inv);
+	for (y = y0; y < y1; y++) {
+		if (y+1 < y1)
+			nsvg__unpremultiplyRow(&image[(y+1)*stride], w, inv);
+		if ((y > y0 || y0 == 0) && (y+1 < y1 || y1 == h))
+			nsvg__defringeRow(image, w, h, y, stride);
+	}
+}
+
+// Defringes the first and last rows of y0..y1 skipped by nsvg__unpremultiplyRows().
+static void nsvg__defringeEdgeRows(unsigned char* image, int w, int h, int y0, int y1, int stride)
+{
+	if (y0 >= y1)
+		return;
+	if (y0 > 0)
+		nsvg__defringeRow(image, w, h, y0, stride);
+	if (y1 < h && y1-1 > y0)
+		nsvg__defringeRow(image, w, h, y1-1, stride);
+}
+
+static void nsvg__unpremultiplyAlpha(unsigned char* image, int w, int h, int stride, const float* inv)
+{
+	nsvg__unpremultiplyRows(image, w, h, 0, h, stride, inv);
+}
+
+// Swaps the red and blue channels of the paint colors, which then composite straight into BGRA pixels.
+static void nsvg__swapRedBlue(NSVGcachedPaint* cache)
+{
+	int i, n = cache->type == NSVG_PAINT_COLOR ? 1 : 256;
+	unsigned int c;
+	for (i = 0; i < n; i++) {
+		c = cache->colors[i];
+		cache->colors[i] = (c & 0xff00ff00u) | ((c & 0xff) << 16) | ((c >> 16) & 0xff);
+	}
+}
+
+// Fills the color table of a gradient with two or more stops.
+static void nsvg__gradientTable(unsigned int* colors, const NSVGgradient* grad, float opacity)
+{
+	unsigned int ca, cb = 0;
+	float ua, ub, du, u;
+	int i, j, ia, ib, count;
+
+	ca = nsvg__applyOpacity(grad->stops[0].color, opacity);
+	ua = nsvg__clampf(grad->stops[0].offset, 0, 1);
+	ub = nsvg__clampf(grad->stops[grad->nstops-1].offset, ua, 1);
+	ia = (int)(ua * 255.0f);
+	ib = (int)(ub * 255.0f);
+	for (i = 0; i < ia; i++) {
+		colors[i] = ca;
+	}
+
+	for (i = 0; i < grad->nstops-1; i++) {
+		ca = nsvg__applyOpacity(grad->stops[i].color, opacity);
+		cb = nsvg__applyOpacity(grad->stops[i+1].color, opacity);
+		ua = nsvg__clampf(grad->stops[i].offset, 0, 1);
+		ub = nsvg__clampf(grad->stops[i+1].offset, 0, 1);
+		ia = (int)(ua * 255.0f);
+		ib = (int)(ub * 255.0f);
+		count = ib - ia;
+		if (count <= 0) continue;
+		u = 0;
+		du = 1.0f / (float)count;
+		for (j = 0; j < count; j++) {
+			colors[ia+j] = nsvg__lerpRGBA(ca,cb,u);
+			u += du;
+		}
+	}
+
+	for (i = ib; i < 256; i++)
+		colors[i] = cb;
+}
+
+static int nsvg__tableOpaque(const unsigned int* colors)
+{
+	int i;
+	for (i = 0; i < 256; i++) {
+		if ((colors[i] >> 24) != 255)
+			return 0;
+	}
+	return 1;
+}
+
+static unsigned int nsvg__hashGradient(const NSVGgradient* grad, float opacity)
+{
+	unsigned int h = 2166136261u, v;
+	int i;
+	memcpy(&v, &opacity, 4);
+	h = (h ^ v) * 16777619u;
+	for (i = 0; i < grad->nstops; i++) {
+		h = (h ^ grad->stops[i].color) * 16777619u;
+		memcpy(&v, &grad->stops[i].offset, 4);
+		h = (h ^ v) * 16777619u;
+	}
+	return h;
+}
+
+// Returns the color table of a gradient with two or more stops from the rasterizer's cache, building it
+// if needed. The table only depends on the stops and the opacity, so it is shared by all shapes and images
+// using the same colors. Returns NULL if the gradient cannot be cached.
+static NSVGcachedGradient* nsvg__cachedGradient(NSVGrasterizer* r, const NSVGgradient* grad, float opacity)
+{
+	NSVGcachedGradient* entry;
+	unsigned int hash;
+
+	if (grad->nstops > NSVG__GRADIENT_CACHE_STOPS)
+		return NULL;
+	if (r->gradients == NULL) {
+		r->gradients = (NSVGcachedGradient*)calloc(NSVG__GRADIENT_CACHE, sizeof(NSVGcachedGradient));
+		if (r->gradients == NULL) return NULL;
+	}
+
+	hash = nsvg__hashGradient(grad, opacity);
+	entry = &r->gradients[hash % NSVG__GRADIENT_CACHE];
+	if (entry->nstops == grad->nstops && entry->hash == hash && entry->opacity == opacity &&
+		memcmp(entry->stops, grad->stops, sizeof(NSVGgradientStop) * grad->nstops) == 0)
+		return entry;
+
+	// Replace whatever was in the slot.
+	entry->hash = hash;
+	entry->opacity = opacity;
+	entry->nstops = grad->nstops;
+	memcpy(entry->stops, grad->stops, sizeof(NSVGgradientStop) * grad->nstops);
+	nsvg__gradientTable(entry->colors, grad, opacity);
+	entry->opaque = (char)nsvg__tableOpaque(entry->colors);
+	return entry;
+}
+
+// Prepares the paint for compositing in the rasterizer's pixel format. The image is drawn at tx,ty,scale,
+// or with r->xform when rendering with nsvgRasterizeXform().
+static void nsvg__initPaint(NSVGrasterizer* r, NSVGcachedPaint* cache, const NSVGpaint* paint, float opacity, float tx, float ty, float scale)
+{
+	int i;
+	const NSVGgradient* grad;
+	NSVGcachedGradient* table;
+	const float* t;
+
+	cache->type = paint->type;
+
+	if (paint->type == NSVG_PAINT_COLOR) {
+		cache->colors[0] = nsvg__applyOpacity(paint->color, opacity);
+		cache->opaque = (cache->colors[0] >> 24) == 255;
+		if (r->format == NSVG_FORMAT_BGRA8)
+			nsvg__swapRedBlue(cache);
+		return;
+	}
+
+	grad = paint->gradient;
+
+	cache->spread = grad->spread;
+
+	// Map pixels to gradient space, undoing the scale and translation of the image.
+	t = grad->xform;
+	if (r->affine) {
+		// Undo the full transform instead, nsvgRasterizeXform() makes sure that it can be inverted.
+		const float* x = r->xform;
+		float det = x[0]*x[3] - x[2]*x[1];
+		float inv[6];
+		inv[0] = x[3] / det;
+		inv[1] = -x[1] / det;
+		inv[2] = -x[2] / det;
+		inv[3] = x[0] / det;
+		inv[4] = (x[2]*x[5] - x[3]*x[4]) / det;
+		inv[5] = (x[1]*x[4] - x[0]*x[5]) / det;
+		cache->xform[0] = inv[0]*t[0] + inv[1]*t[2];
+		cache->xform[1] = inv[0]*t[1] + inv[1]*t[3];
+		cache->xform[2] = inv[2]*t[0] + inv[3]*t[2];
+		cache->xform[3] = inv[2]*t[1] + inv[3]*t[3];
+		cache->xform[4] = inv[4]*t[0] + inv[5]*t[2] + t[4];
+		cache->xform[5] = inv[4]*t[1] + inv[5]*t[3] + t[5];
+	} else {
+		cache->xform[0] = t[0] / scale;
+		cache->xform[1] = t[1] / scale;
+		cache->xform[2] = t[2] / scale;
+		cache->xform[3] = t[3] / scale;
+		cache->xform[4] = t[4] - (tx*t[0] + ty*t[2]) / scale;
+		cache->xform[5] = t[5] - (tx*t[1] + ty*t[3]) / scale;
+	}
+
+	if (grad->nstops == 0) {
+		for (i = 0; i < 256; i++)
+			cache->colors[i] = 0;
+		cache->opaque = 0;
+	} else if (grad->nstops == 1) {
+		unsigned int color = nsvg__applyOpacity(grad->stops[0].color, opacity);
+		for (i = 0; i < 256; i++)
+			cache->colors[i] = color;
+		cache->opaque = (color >> 24) == 255;
+	} else if ((table = nsvg__cachedGradient(r, grad, opacity)) != NULL) {
+		memcpy(cache->colors, table->colors, sizeof(cache->colors));
+		cache->opaque = table->opaque;
+	} else {
+		nsvg__gradientTable(cache->colors, grad, opacity);
+		cache->opaque = (char)nsvg__tableOpaque(cache->colors);
+	}
+
+	if (r->format == NSVG_FORMAT_BGRA8)
+		nsvg__swapRedBlue(cache);
+}
+
+/*
+static void dumpEdges(NSVGrasterizer* r, const char* name)
+{
+	float xmin = 0, xmax = 0, ymin = 0, ymax = 0;
+	NSVGedge *e = NULL;
+	int i;
+	if (r->nedges == 0) return;
+	FILE* fp = fopen(name, "w");
+	if (fp == NULL) return;
+
+	xmin = xmax = r->edges[0].x0;
+	ymin = ymax = r->edges[0].y0;
+	for (i = 0; i < r->nedges; i++) {
+		e = &r->edges[i];
+		xmin = nsvg__minf(xmin, e->x0);
+		xmin = nsvg__minf(xmin, e->x1);
+		xmax = nsvg__maxf(xmax, e->x0);
+		xmax = nsvg__maxf(xmax, e->x1);
+		ymin = nsvg__minf(ymin, e->y0);
+		ymin = nsvg__minf(ymin, e->y1);
+		ymax = nsvg__maxf(ymax, e->y0);
+		ymax = nsvg__maxf(ymax, e->y1);
+	}
+
+	fprintf(fp, "<svg viewBox=\"%f %f %f %f\" xmlns=\"http://www.w3.org/2000/svg\">", xmin, ymin, (xmax - xmin), (ymax - ymin));
+
+	for (i = 0; i < r->nedges; i++) {
+		e = &r->edges[i];
+		fprintf(fp ,"<line x1=\"%f\" y1=\"%f\" x2=\"%f\" y2=\"%f\" style=\"stroke:#000;\" />", e->x0,e->y0, e->x1,e->y1);
+	}
+
+	for (i = 0; i < r->npoints; i++) {
+		if (i+1 < r->npoints)
+			fprintf(fp ,"<line x1=\"%f\" y1=\"%f\" x2=\"%f\" y2=\"%f\" style=\"stroke:#f00;\" />", r->points[i].x, r->points[i].y, r->points[i+1].x, r->points[i+1].y);
+		fprintf(fp ,"<circle cx=\"%f\" cy=\"%f\" r=\"1\" style=\"fill:%s;\" />", r->points[i].x, r->points[i].y, r->points[i].flags == 0 ? "#f00" : "#0f0");
+	}
+
+	fprintf(fp, "</svg>");
+	fclose(fp);
+}
+*/
+
+// Moves the edges to image space, with y in sub-scanlines. Edges above or below the destination are dropped,
+// and edges entirely left or right of it are replaced by vertical edges just outside of it. Neither changes
+// the winding inside the destination.
+// Returns 0 if the edge is dropped.
+static int nsvg__placeEdge(NSVGrasterizer* r, NSVGedge* e, float tx, float ty)
+{
+	float left = (float)(r->ox - 1), right = (float)(r->ox + r->width + 1);
+	float top = (float)((r->oy - 1) * r->subsamples), bottom = (float)((r->oy + r->height + 1) * r->subsamples);
+	float slack;
+
+	e->x0 = tx + e->x0;
+	e->y0 = (ty + e->y0) * r->subsamples;
+	e->x1 = tx + e->x1;
+	e->y1 = (ty + e->y1) * r->subsamples;
+	if (nsvg__edgeBottom(e) < top || nsvg__edgeTop(e) > bottom)
+		return 0;
+	// Keep edges which may step into the destination due to fixed point error.
+	slack = 1.0f + (nsvg__absf(e->y1 - e->y0) + 1.0f) * (0.5f / NSVG__FIX);
+	if (e->x0 + slack < left && e->x1 + slack < left)
+		e->x0 = e->x1 = left;
+	else if (e->x0 - slack > right && e->x1 - slack > right)
+		e->x0 = e->x1 = right;
+	return 1;
+}
+
+// Places the sides of a shape tagged NSVG_FLAGS_RECT like nsvg__placeEdge() would place its vertical edges,
+// as left, top, right and bottom in rect. Returns 0 if the shape has to go through the edge list after all:
+// the image is transformed, the points do not form an axis aligned rectangle, or flattening would merge
+// the corners of a short side.
+static int nsvg__placeRect(NSVGrasterizer* r, const NSVGshape* shape, float tx, float ty, float scale, float* rect)
+{
+	float left = (float)(r->ox - 1), right = (float)(r->ox + r->width + 1);
+	const NSVGpath* path = shape->paths;
+	const float* p;
+	float x0, y0, x1, y1, slack;
+	int i, j, k, ok = 0;
+
+	if (r->affine || path == NULL || path->next != NULL || path->npts != 13)
+		return 0;
+	p = path->pts;
+	if (p[24] != p[0] || p[25] != p[1])
+		return 0;
+	// The sides must alternate between horizontal and vertical, control points included.
+	for (k = 0; k < 2 && !ok; k++) {
+		ok = 1;
+		for (i = 0; i < 4 && ok; i++) {
+			const float* side = &p[i*6];
+			int c = (i + k) & 1;
+			for (j = 1; j < 4; j++)
+				if (side[j*2+c] != side[c]) ok = 0;
+		}
+	}
+	if (!ok)
+		return 0;
+
+	x0 = p[0]*scale;
+	y0 = p[1]*scale;
+	x1 = p[12]*scale;
+	y1 = p[13]*scale;
+	if (nsvg__absf(x1 - x0) <= r->distTol || nsvg__absf(y1 - y0) <= r->distTol)
+		return 0;
+	if (x0 > x1) { float t = x0; x0 = x1; x1 = t; }
+	if (y0 > y1) { float t = y0; y0 = y1; y1 = t; }
+
+	rect[0] = tx + x0;
+	rect[1] = (ty + y0) * r->subsamples;
+	rect[2] = tx + x1;
+	rect[3] = (ty + y1) * r->subsamples;
+	slack = 1.0f + (nsvg__absf(rect[3] - rect[1]) + 1.0f) * (0.5f / NSVG__FIX);
+	for (i = 0; i < 4; i += 2) {
+		if (rect[i] + slack < left)
+			rect[i] = left;
+		else if (rect[i] - slack > right)
+			rect[i] = right;
+	}
+	return 1;
+}
+
+static void nsvg__translateEdges(NSVGrasterizer* r, float tx, float ty)
+{
+	int i, n = 0;
+
+	for (i = 0; i < r->nedges; i++) {
+		NSVGedge e = r->edges[i];
+		if (nsvg__placeEdge(r, &e, tx, ty))
+			r->edges[n++] = e;
+	}
+	r->nedges = n;
+}
+
+// Moves a shape's cached edges to image space like nsvg__translateEdges(). The cached edges are sorted,
+// and moving them keeps the order, except that edges can end up with equal tops. Those are put back in
+// the order they were emitted in, so that the result is the same as sorting with nsvg__sortEdges().
+static void nsvg__placeCachedEdges(NSVGrasterizer* r, NSVGrasterCache* cache, int start, int count, float tx, float ty)
+{
+	int i, j, n = 0;
+	int* order;
+
+	r->nedges = 0;
+	if (r->cedges < count) {
+		r->cedges = count;
+		r->edges = (NSVGedge*)realloc(r->edges, sizeof(NSVGedge) * r->cedges);
+		if (r->edges == NULL) return;
+	}
+	if (r->cbuckets < count) {
+		r->cbuckets = count;
+		r->buckets = (int*)realloc(r->buckets, sizeof(int) * r->cbuckets);
+		if (r->buckets == NULL) return;
+	}
+	order = r->buckets;
+
+	for (i = 0; i < count; i++) {
+		NSVGedge e = cache->edges[start + i];
+		int k = cache->order[start + i];
+		float top;
+		if (!nsvg__placeEdge(r, &e, tx, ty))
+			continue;
+		top = nsvg__edgeTop(&e);
+		for (j = n; j > 0 && order[j-1] > k && nsvg__edgeTop(&r->edges[j-1]) == top; j--) {
+			r->edges[j] = r->edges[j-1];
+			order[j] = order[j-1];
+		}
+		r->edges[j] = e;
+		order[j] = k;
+		n++;
+	}
+	r->nedges = n;
+}
+
+// Returns in out the image space bounds of what a shape can draw, 0 if it draws nothing.
+// Mirrors the culling in nsvg__rasterizeShapes().
+static int nsvg__shapeBounds(NSVGrasterizer* r, const NSVGshape* shape, float tx, float ty, float scale, float* out)
+{
+	float b[4];
+	int n = 0;
+
+	if (!(shape->flags & NSVG_FLAGS_VISIBLE))
+		return 0;
+	if (shape->fill.type != NSVG_PAINT_NONE) {
+		nsvg__pixelBounds(r, shape->bounds, tx, ty, scale, 0.0f, out);
+		n++;
+	}
+	if (shape->stroke.type != NSVG_PAINT_NONE && (shape->strokeWidth * scale) > 0.01f) {
+		nsvg__pixelBounds(r, shape->bounds, tx, ty, scale, nsvg__strokeExtent(shape, scale), b);
+		if (n == 0 || b[0] < out[0]) out[0] = b[0];
+		if (n == 0 || b[1] < out[1]) out[1] = b[1];
+		if (n == 0 || b[2] > out[2]) out[2] = b[2];
+		if (n == 0 || b[3] > out[3]) out[3] = b[3];
+		n++;
+	}
+	return n > 0;
+}
+
+// Adds the turn from direction dx0,dy0 to dx,dy, returns 0 if it turns back or the other way than before.
+static int nsvg__convexCorner(float dx0, float dy0, float dx, float dy, int* dir, float* turn)
+{
+	float cross = dx0*dy - dy0*dx;
+	float dot = dx0*dx + dy0*dy;
+	// Treat nearly straight corners as straight, lines are stored as curves with rounded control points.
+	if (cross*cross <= 1e-10f * (dx0*dx0 + dy0*dy0) * (dx*dx + dy*dy))
+		return dot > 0.0f;
+	if (*dir == 0)
+		*dir = cross > 0.0f ? 1 : -1;
+	if ((cross > 0.0f ? 1 : -1) != *dir)
+		return 0;
+	*turn += atan2f(cross, dot);
+	return 1;
+}
+
+// Returns 1 if the fill of a shape is an opaque convex area. It has to be a single path whose control
+// points form a convex polygon turning around once. The curve is then convex too, and contains the
+// polygon through the end points of its segments.
+static int nsvg__convexOccluder(const NSVGshape* shape)
+{
+	const NSVGpath* path = shape->paths;
+	float fx = 0, fy = 0, dx0 = 0, dy0 = 0, turn = 0.0f;
+	int i, n, dir = 0, first = 1;
+
+	if (shape->fill.type != NSVG_PAINT_COLOR || (nsvg__applyOpacity(shape->fill.color, shape->opacity) >> 24) != 255)
+		return 0;
+	if (path == NULL || path->next != NULL || path->npts < 4)
+		return 0;
+
+	// Walk around the control polygon, the fill closes the path back to the first point.
+	n = path->npts;
+	for (i = 0; i < n; i++) {
+		const float* a = &path->pts[i*2];
+		const float* b = &path->pts[((i+1) % n)*2];
+		float dx = b[0] - a[0], dy = b[1] - a[1];
+		if (dx == 0.0f && dy == 0.0f)
+			continue;
+		if (first) {
+			fx = dx;
+			fy = dy;
+			first = 0;
+		} else if (!nsvg__convexCorner(dx0, dy0, dx, dy, &dir, &turn)) {
+			return 0;
+		}
+		dx0 = dx;
+		dy0 = dy;
+	}
+	if (first || !nsvg__convexCorner(dx0, dy0, fx, fy, &dir, &turn))
+		return 0;
+	return dir != 0 && fabsf(turn) > 1.9f * NSVG_PI && fabsf(turn) < 2.1f * NSVG_PI;
+}
+
+// Returns in lo,hi the horizontal extent of the polygon at y, 0 if it does not reach y.
+static int nsvg__polygonChord(const float* pts, int npts, float y, float* lo, float* hi)
+{
+	int i, j, hit = 0;
+	for (i = 0, j = npts-1; i < npts; j = i++) {
+		float ax = pts[j*2], ay = pts[j*2+1], bx = pts[i*2], by = pts[i*2+1], x;
+		if (ay == by || y < (ay < by ? ay : by) || y > (ay > by ? ay : by))
+			continue;
+		x = ax + (y - ay) * (bx - ax) / (by - ay);
+		if (!hit || x < *lo) *lo = x;
+		if (!hit || x > *hi) *hi = x;
+		hit = 1;
+	}
+	return hit;
+}
+
+// Marks the tiles which a convex occluder fills completely. The polygon through the end points of its
+// segments is shrunk by the error of the rasterizer, so that each pixel of a marked tile gets full coverage.
+static void nsvg__addOccluder(NSVGrasterizer* r, const NSVGshape* shape, float tx, float ty, float scale,
+							  unsigned char* tiles, int tw, int th)
+{
+	const NSVGpath* path = shape->paths;
+	float* poly = r->occluder;
+	float y0 = 1e30f, y1 = -1e30f, slackx;
+	int i, n = 0, row, col, row0, row1;
+
+	for (i = 0; i < path->npts; i += 3) {
+		float x = path->pts[i*2] * scale, y = path->pts[i*2+1] * scale;
+		if (r->affine) {
+			float* m = r->linear;
+			float ax = x*m[0] + y*m[2], ay = x*m[1] + y*m[3];
+			x = ax;
+			y = ay;
+		}
+		poly[n*2] = x + tx - (float)r->ox;
+		poly[n*2+1] = y + ty - (float)r->oy;
+		if (poly[n*2+1] < y0) y0 = poly[n*2+1];
+		if (poly[n*2+1] > y1) y1 = poly[n*2+1];
+		n++;
+	}
+	if (n < 3 || y1 < 0.0f || y0 > (float)r->height)
+		return;
+	// The same horizontal slack as in nsvg__pixelBounds().
+	slackx = 1.0f + ((y1 - y0) * r->subsamples + 1.0f) * (0.5f / NSVG__FIX);
+	row0 = y0 > 0.0f ? (int)y0 >> NSVG__OCCLUSION_SHIFT : 0;
+	row1 = y1 < (float)r->height ? (int)y1 >> NSVG__OCCLUSION_SHIFT : th-1;
+
+	for (row = row0; row <= row1; row++) {
+		int ty0 = row << NSVG__OCCLUSION_SHIFT, ty1 = ty0 + (1 << NSVG__OCCLUSION_SHIFT);
+		float lo0, hi0, lo1, hi1, lo, hi;
+		if (ty1 > r->height) ty1 = r->height;
+		// The polygon is convex, so the tiles of the row are inside if their corners are.
+		if (!nsvg__polygonChord(poly, n, (float)ty0 - 1.0f, &lo0, &hi0) ||
+			!nsvg__polygonChord(poly, n, (float)ty1 + 1.0f, &lo1, &hi1))
+			continue;
+		lo = (lo0 > lo1 ? lo0 : lo1) + slackx;
+		hi = (hi0 < hi1 ? hi0 : hi1) - slackx;
+		if (lo >= hi || hi < 0.0f || lo > (float)r->width)
+			continue;
+		for (col = lo > 0.0f ? (int)lo >> NSVG__OCCLUSION_SHIFT : 0; col < tw; col++) {
+			int tx0 = col << NSVG__OCCLUSION_SHIFT, tx1 = tx0 + (1 << NSVG__OCCLUSION_SHIFT);
+			if (tx1 > r->width) tx1 = r->width;
+			if ((float)tx1 > hi)
+				break;
+			if ((float)tx0 >= lo)
+				tiles[row*tw + col] = 1;
+		}
+	}
+}
+
+// Grows the buffers used to find hidden shapes, for nshapes shapes, occluders of up to npoly polygon
+// points and ntiles tiles.
+static int nsvg__reserveOcclusion(NSVGrasterizer* r, int nshapes, int npoly, int ntiles)
+{
+	int cshapes = r->cshapes;
+	r->shapes = (const NSVGshape**)nsvg__reserveBuffer(r->shapes, &r->cshapes, nshapes, sizeof(NSVGshape*));
+	r->culled = (unsigned char*)nsvg__reserveBuffer(r->culled, &cshapes, nshapes, 1);
+	if (r->cshapes < nshapes || cshapes < nshapes) {
+		r->cshapes = 0;
+		return 0;
+	}
+	r->occluder = (float*)nsvg__reserveBuffer(r->occluder, &r->coccluder, npoly*2, sizeof(float));
+	r->tiles = (unsigned char*)nsvg__reserveBuffer(r->tiles, &r->ctiles, ntiles, 1);
+	return r->coccluder >= npoly*2 && r->ctiles >= ntiles;
+}
+
+// Walks the shapes back to front and flags in r->culled the ones hidden by later opaque convex shapes,
+// tracked as fully covered tiles of the target. Returns 0 if the buffers could not be allocated.
+static int nsvg__cullOccluded(NSVGrasterizer* r, const NSVGimage* image, float tx, float ty, float scale)
+{
+	const NSVGshape* shape;
+	int tw = (r->width + (1 << NSVG__OCCLUSION_SHIFT) - 1) >> NSVG__OCCLUSION_SHIFT;
+	int th = (r->height + (1 << NSVG__OCCLUSION_SHIFT) - 1) >> NSVG__OCCLUSION_SHIFT;
+	int i, n = 0;
+
+	for (shape = image->shapes; shape != NULL; shape = shape->next)
+		n++;
+	if (!nsvg__reserveOcclusion(r, n, 0, tw*th))
+		return 0;
+	memset(r->tiles, 0, tw*th);
+	memset(r->culled, 0, n);
+	for (shape = image->shapes, i = 0; shape != NULL; shape = shape->next)
+		r->shapes[i++] = shape;
+
+	for (i = n-1; i >= 0; i--) {
+		float b[4];
+		int x0, y0, x1, y1, x, y, covered = 1;
+		shape = r->shapes[i];
+		if (!nsvg__shapeBounds(r, shape, tx, ty, scale, b))
+			continue;
+		b[0] -= (float)r->ox;
+		b[1] -= (float)r->oy;
+		b[2] -= (float)r->ox;
+		b[3] -= (float)r->oy;
+		// Shapes outside of the target are skipped anyway.
+		if (b[2] < 0.0f || b[3] < 0.0f || b[0] > (float)r->width || b[1] > (float)r->height)
+			continue;
+		x0 = b[0] > 0.0f ? (int)b[0] >> NSVG__OCCLUSION_SHIFT : 0;
+		y0 = b[1] > 0.0f ? (int)b[1] >> NSVG__OCCLUSION_SHIFT : 0;
+		x1 = b[2] < (float)r->width ? (int)b[2] >> NSVG__OCCLUSION_SHIFT : tw-1;
+		y1 = b[3] < (float)r->height ? (int)b[3] >> NSVG__OCCLUSION_SHIFT : th-1;
+		for (y = y0; y <= y1 && covered; y++) {
+			for (x = x0; x <= x1; x++) {
+				if (!r->tiles[y*tw + x]) {
+					covered = 0;
+					break;
+				}
 			}
-			row += 4;
 		}
+		if (covered) {
+			r->culled[i] = 1;
+			continue;
+		}
+		// Only shapes large enough to cover a whole tile are worth testing.
+		if (b[2] - b[0] > (float)(2 << NSVG__OCCLUSION_SHIFT) && b[3] - b[1] > (float)(2 << NSVG__OCCLUSION_SHIFT) &&
+			nsvg__convexOccluder(shape)) {
+			if (!nsvg__reserveOcclusion(r, n, (shape->paths->npts + 2) / 3, tw*th))
+				return 0;
+			nsvg__addOccluder(r, shape, tx, ty, scale, r->tiles, tw, th);
+		}
+	}
+	return 1;
+}
+
+// Renders the shapes, with their edges taken from 'geom' when it is not NULL.
+static void nsvg__rasterizeShapes(NSVGrasterizer* r, const NSVGimage* image, NSVGrasterCache* geom, float tx, float ty, float scale)
+{
+	const NSVGshape *shape = NULL;
+	NSVGcachedPaint cache;
+    int i, j, culled;
+    unsigned char paintOrder;
+
+	culled = r->occlusion && r->bitmap != NULL && nsvg__cullOccluded(r, image, tx, ty, scale);
+
+	for (shape = image->shapes, i = 0; shape != NULL; shape = shape->next, i++) {
+		if (!(shape->flags & NSVG_FLAGS_VISIBLE))
+			continue;
+		if (culled && r->culled[i])
+			continue;
+
+        for (j = 0; j < 3; j++) {
+            paintOrder = (shape->paintOrder >> (2 * j)) & 0x03;
+
+            if (paintOrder == NSVG_PAINT_FILL && shape->fill.type != NSVG_PAINT_NONE && nsvg__boundsVisible(r, shape->bounds, tx, ty, scale, 0.0f)) {
+                float rect[4];
+                if (r->bitmap != NULL && (shape->flags & NSVG_FLAGS_RECT) && nsvg__placeRect(r, shape, tx, ty, scale, rect)) {
+                    // Axis aligned rectangles are filled directly.
+                    nsvg__initPaint(r, &cache, &shape->fill, shape->opacity, tx, ty, scale);
+                    nsvg__rasterizeRect(r, &cache, rect, shape->fillRule);
+                    continue;
+                }
+                if (geom != NULL) {
+                    nsvg__placeCachedEdges(r, geom, geom->shapes[i].fill, geom->shapes[i].nfill, tx, ty);
+                } else {
+                    r->nedges = 0;
+
+                    nsvg__flattenShape(r, shape, tx, ty, scale);
+
+                    // Scale and translate edges
+                    nsvg__translateEdges(r, tx, ty);
+
+                    // Rasterize edges
+                    nsvg__sortEdges(r);
+                }
+
+                // now, traverse the scanlines and find the intersections on each scanline, use non-zero rule
+                nsvg__initPaint(r, &cache, &shape->fill, shape->opacity, tx, ty, scale);
+
+                nsvg__rasterizeSortedEdges(r, &cache, shape->fillRule);
+            }
+            if (paintOrder == NSVG_PAINT_STROKE && shape->stroke.type != NSVG_PAINT_NONE && (shape->strokeWidth * scale) > 0.01f &&
+                nsvg__boundsVisible(r, shape->bounds, tx, ty, scale, nsvg__strokeExtent(shape, scale))) {
+                if (geom != NULL) {
+                    nsvg__placeCachedEdges(r, geom, geom->shapes[i].stroke, geom->shapes[i].nstroke, tx, ty);
+                } else {
+                    r->nedges = 0;
+
+                    nsvg__flattenShapeStroke(r, shape, tx, ty, scale);
+
+        //			dumpEdges(r, "edge.svg");
+
+                    // Scale and translate edges
+                    nsvg__translateEdges(r, tx, ty);
+
+                    // Rasterize edges
+                    nsvg__sortEdges(r);
+                }
+
+                // now, traverse the scanlines and find the intersections on each scanline, use non-zero rule
+                nsvg__initPaint(r, &cache, &shape->stroke, shape->opacity, tx, ty, scale);
+
+                nsvg__rasterizeSortedEdges(r, &cache, NSVG_FILLRULE_NONZERO);
+            }
+        }
+	}
+}
+
+static int nsvg__setTarget(NSVGrasterizer* r, unsigned char* bitmap, int w, int h, int stride, int ox, int oy)
+{
+	r->bitmap = bitmap;
+	r->width = w;
+	r->height = h;
+	r->stride = stride;
+	r->ox = ox;
+	r->oy = oy;
+
+	if (w > r->cscanline) {
+		r->cscanline = w;
+		r->scanline = (unsigned char*)realloc(r->scanline, w);
+		if (r->scanline == NULL) return 0;
+		memset(r->scanline, 0, w);
+	}
+
+	return 1;
+}
+
+static void nsvg__resetTarget(NSVGrasterizer* r)
+{
+	r->bitmap = NULL;
+	r->width = 0;
+	r->height = 0;
+	r->stride = 0;
+	r->ox = 0;
+	r->oy = 0;
+	r->affine = 0;
+}
+
+// Clears the pixels x0..x1 of rows y0..y1 to transparent black.
+static void nsvg__clearRect(NSVGrasterizer* r, unsigned char* dst, int stride, int x0, int y0, int x1, int y1)
+{
+	int y;
+	if (x0 >= x1)
+		return;
+	for (y = y0; y < y1; y++) {
+		unsigned char* row = &dst[y*stride];
+		if (r->format == NSVG_FORMAT_RGBA8 || r->format == NSVG_FORMAT_BGRA8)
+			memset(&row[x0*4], 0, (x1-x0)*4);
+		else if (r->format == NSVG_FORMAT_RGB565)
+			memset(&row[x0*2], 0, (x1-x0)*2);
+		else if (r->format == NSVG_FORMAT_A8)
+			memset(&row[x0], 0, x1-x0);
+		else
+			nsvg__fillSpanMask1(row, x0, x1-x0, 0);
+	}
+}
+
+// Returns true if the rendered image has to be unpremultiplied and defringed.
+static int nsvg__needsUnpremultiply(NSVGrasterizer* r)
+{
+	return !r->premultiplied && (r->format == NSVG_FORMAT_RGBA8 || r->format == NSVG_FORMAT_BGRA8);
+}
+
+// Converts image space bounds to the pixels x0,y0,x1,y1 of a w by h target at ox,oy which they touch,
+// grown by 'grow' pixels. Returns an all zero rectangle if nothing is inside the target.
+static void nsvg__pixelRect(const float* b, int ox, int oy, int w, int h, int grow, int* rect)
+{
+	// Clamp before converting to int, the bounds can be far outside the target.
+	float x0 = b[0] - (float)ox, y0 = b[1] - (float)oy;
+	float x1 = b[2] - (float)ox, y1 = b[3] - (float)oy;
+	if (x0 < -1.0f) x0 = -1.0f;
+	if (y0 < -1.0f) y0 = -1.0f;
+	if (x1 > (float)w + 1.0f) x1 = (float)w + 1.0f;
+	if (y1 > (float)h + 1.0f) y1 = (float)h + 1.0f;
+	if (!(x0 < x1 && y0 < y1)) {
+		rect[0] = rect[1] = rect[2] = rect[3] = 0;
+		return;
+	}
+	rect[0] = (int)floorf(x0) - grow;
+	rect[1] = (int)floorf(y0) - grow;
+	rect[2] = (int)ceilf(x1) + grow;
+	rect[3] = (int)ceilf(y1) + grow;
+	if (rect[0] < 0) rect[0] = 0;
+	if (rect[1] < 0) rect[1] = 0;
+	if (rect[2] > w) rect[2] = w;
+	if (rect[3] > h) rect[3] = h;
+	if (rect[0] >= rect[2] || rect[1] >= rect[3])
+		rect[0] = rect[1] = rect[2] = rect[3] = 0;
+}
+
+// Computes the rectangle x0,y0,x1,y1 of a w by h target at ox,oy that rendering the image can change.
+// It is the whole target unless only the bounds are cleared, then it is the union of the shape bounds
+// grown by a pixel, so that defringing only this area is the same as defringing the whole image.
+static void nsvg__drawnRect(NSVGrasterizer* r, const NSVGimage* image, float tx, float ty, float scale,
+							int ox, int oy, int w, int h, int* rect)
+{
+	const NSVGshape* shape;
+	float b[4], u[4] = {1e30f, 1e30f, -1e30f, -1e30f};
+
+	rect[0] = 0;
+	rect[1] = 0;
+	rect[2] = w;
+	rect[3] = h;
+	if (r->clear != NSVG_CLEAR_BOUNDS)
+		return;
+
+	for (shape = image->shapes; shape != NULL; shape = shape->next) {
+		if (!nsvg__shapeBounds(r, shape, tx, ty, scale, b))
+			continue;
+		if (b[0] < u[0]) u[0] = b[0];
+		if (b[1] < u[1]) u[1] = b[1];
+		if (b[2] > u[2]) u[2] = b[2];
+		if (b[3] > u[3]) u[3] = b[3];
+	}
+	nsvg__pixelRect(u, ox, oy, w, h, 1, rect);
+}
+
+// Clears the target as selected by nsvgRasterizerSetClear(), returns the area that will be drawn to in rect.
+static void nsvg__beginTarget(NSVGrasterizer* r, const NSVGimage* image, float tx, float ty, float scale, int* rect)
+{
+	nsvg__drawnRect(r, image, tx, ty, scale, r->ox, r->oy, r->width, r->height, rect);
+	if (r->clear != NSVG_CLEAR_NONE)
+		nsvg__clearRect(r, r->bitmap, r->stride, rect[0], rect[1], rect[2], rect[3]);
+}
+
+// Unpremultiplies the area drawn to, if needed, and releases the target.
+static void nsvg__endTarget(NSVGrasterizer* r, const int* rect)
+{
+	if (nsvg__needsUnpremultiply(r) && rect[0] < rect[2])
+		nsvg__unpremultiplyAlpha(&r->bitmap[rect[1]*r->stride + rect[0]*4], rect[2]-rect[0], rect[3]-rect[1], r->stride, r->unpremul);
+	nsvg__resetTarget(r);
+}
+
+void nsvgRasterize(NSVGrasterizer* r,
+				   const NSVGimage* image, float tx, float ty, float scale,
+				   unsigned char* dst, int w, int h, int stride)
+{
+	int rect[4];
+
+	if (!nsvg__setTarget(r, dst, w, h, stride, 0, 0))
+		return;
+
+	nsvg__beginTarget(r, image, tx, ty, scale, rect);
+
+	nsvg__rasterizeShapes(r, image, NULL, tx, ty, scale);
+
+	nsvg__endTarget(r, rect);
+}
+
+void nsvgRasterizeXform(NSVGrasterizer* r,
+						const NSVGimage* image, const float* xform,
+						unsigned char* dst, int w, int h, int stride)
+{
+	float a = xform[0], b = xform[1], c = xform[2], d = xform[3];
+	float det = a*d - c*b, e, scale;
+	int i, rect[4];
+
+	if (b == 0.0f && c == 0.0f && a == d && a > 0.0f) {
+		nsvgRasterize(r, image, xform[4], xform[5], a, dst, w, h, stride);
+		return;
+	}
+
+	if (!nsvg__setTarget(r, dst, w, h, stride, 0, 0))
+		return;
+
+	// Flatten and stroke at the largest scale of the matrix, so that the remaining linear part only
+	// shrinks and the flattening error stays within the tolerance.
+	e = a*a + b*b + c*c + d*d;
+	scale = sqrtf(0.5f * (e + sqrtf(nsvg__absf(e*e - 4.0f*det*det))));
+	if (scale > 0.0f && det != 0.0f) {
+		r->affine = 1;
+		for (i = 0; i < 6; i++)
+			r->xform[i] = xform[i];
+		r->linear[0] = a / scale;
+		r->linear[1] = b / scale;
+		r->linear[2] = c / scale;
+		r->linear[3] = d / scale;
+	} else {
+		scale = 0.0f;
+	}
+
+	nsvg__beginTarget(r, image, xform[4], xform[5], scale, rect);
+
+	// A matrix which cannot be inverted flattens the shapes into lines or points, which cover nothing.
+	if (r->affine)
+		nsvg__rasterizeShapes(r, image, NULL, xform[4], xform[5], scale);
+
+	nsvg__endTarget(r, rect);
+}
+
+void nsvgRasterizeRegion(NSVGrasterizer* r,
+						 const NSVGimage* image, float tx, float ty, float scale,
+						 int x, int y, int w, int h,
+						 unsigned char* dst, int stride)
+{
+	int rect[4];
+
+	if (!nsvg__setTarget(r, dst, w, h, stride, x, y))
+		return;
+
+	nsvg__beginTarget(r, image, tx, ty, scale, rect);
+
+	nsvg__rasterizeShapes(r, image, NULL, tx, ty, scale);
+
+	nsvg__endTarget(r, rect);
+}
+
+void nsvgRasterizerShapeRect(NSVGrasterizer* r, const NSVGshape* shape, float tx, float ty, float scale, int* rect)
+{
+	float b[4];
+	if (!nsvg__shapeBounds(r, shape, tx, ty, scale, b)) {
+		rect[0] = rect[1] = rect[2] = rect[3] = 0;
+		return;
+	}
+	// Keep the rectangle within the range of int.
+	nsvg__pixelRect(b, -(1 << 24), -(1 << 24), 1 << 25, 1 << 25, 0, rect);
+	rect[0] -= 1 << 24;
+	rect[1] -= 1 << 24;
+	rect[2] -= 1 << 24;
+	rect[3] -= 1 << 24;
+}
+
+// Re-renders the pixels x0,y0,x1,y1 of dst, see nsvgRasterizeDirty().
+static void nsvg__renderDirtyRect(NSVGrasterizer* r, const NSVGimage* image, float tx, float ty, float scale,
+								  const int* rect, unsigned char* dst, int w, int h, int stride)
+{
+	int x0 = rect[0], y0 = rect[1], x1 = rect[2], y1 = rect[3];
+	int ex0, ey0, ex1, ey1, y;
+
+	if (!nsvg__needsUnpremultiply(r) || r->clear == NSVG_CLEAR_NONE) {
+		int offset;
+		if (r->format == NSVG_FORMAT_RGBA8 || r->format == NSVG_FORMAT_BGRA8)
+			offset = x0*4;
+		else if (r->format == NSVG_FORMAT_RGB565)
+			offset = x0*2;
+		else if (r->format == NSVG_FORMAT_A8)
+			offset = x0;
+		else
+			offset = x0/8;	// Aligned to a byte by nsvgRasterizeDirty().
+		nsvgRasterizeRegion(r, image, tx, ty, scale, x0, y0, x1-x0, y1-y0, &dst[y0*stride + offset], stride);
+		return;
+	}
+
+	// Defringing the pixels at the edge of the rectangle reads the pixels around it, which a region
+	// treats as outside of the image. Render two more pixels all around into a scratch image and copy
+	// the inside back, the second pixel because the defringing skips neighbours in the first column and row.
+	ex0 = x0-2 > 0 ? x0-2 : 0;
+	ey0 = y0-2 > 0 ? y0-2 : 0;
+	ex1 = x1+2 < w ? x1+2 : w;
+	ey1 = y1+2 < h ? y1+2 : h;
+	if ((ex1-ex0)*(ey1-ey0)*4 > r->cscratch) {
+		unsigned char* scratch = (unsigned char*)realloc(r->scratch, (ex1-ex0)*(ey1-ey0)*4);
+		if (scratch == NULL) return;
+		r->scratch = scratch;
+		r->cscratch = (ex1-ex0)*(ey1-ey0)*4;
+	}
+	nsvgRasterizeRegion(r, image, tx, ty, scale, ex0, ey0, ex1-ex0, ey1-ey0, r->scratch, (ex1-ex0)*4);
+	for (y = y0; y < y1; y++)
+		memcpy(&dst[y*stride + x0*4], &r->scratch[((y-ey0)*(ex1-ex0) + x0-ex0)*4], (x1-x0)*4);
+}
+
+void nsvgRasterizeDirty(NSVGrasterizer* r,
+						const NSVGimage* image, float tx, float ty, float scale,
+						NSVGshape** shapes, int nshapes, const int* rects, int nrects,
+						unsigned char* dst, int w, int h, int stride)
+{
+	// Transparent pixels next to the changed ones are defringed from them, and change too.
+	int grow = nsvg__needsUnpremultiply(r) && r->clear != NSVG_CLEAR_NONE ? 1 : 0;
+	int clear = r->clear;
+	int i, j, n = 0, merged;
+	int* d;
+
+	if (nshapes + nrects > r->cdirty) {
+		d = (int*)realloc(r->dirty, sizeof(int) * 4 * (nshapes + nrects));
+		if (d == NULL) return;
+		r->dirty = d;
+		r->cdirty = nshapes + nrects;
+	}
+	d = r->dirty;
+
+	for (i = 0; i < nshapes + nrects; i++) {
+		int* rc = &d[n*4];
+		if (i < nshapes) {
+			nsvgRasterizerShapeRect(r, shapes[i], tx, ty, scale, rc);
+		} else {
+			for (j = 0; j < 4; j++)
+				rc[j] = rects[(i-nshapes)*4 + j];
+		}
+		// Skip the rectangles which have no pixels in the image, before growing them.
+		if (rc[0] < 0) rc[0] = 0;
+		if (rc[1] < 0) rc[1] = 0;
+		if (rc[2] > w) rc[2] = w;
+		if (rc[3] > h) rc[3] = h;
+		if (rc[0] >= rc[2] || rc[1] >= rc[3])
+			continue;
+		rc[0] = rc[0] - grow > 0 ? rc[0] - grow : 0;
+		rc[1] = rc[1] - grow > 0 ? rc[1] - grow : 0;
+		rc[2] = rc[2] + grow < w ? rc[2] + grow : w;
+		rc[3] = rc[3] + grow < h ? rc[3] + grow : h;
+		// A region of a mask starts at a byte.
+		if (r->format == NSVG_FORMAT_MASK1)
+			rc[0] &= ~7;
+		n++;
 	}
 
-	// Defringe
-	for (y = 0; y < h; y++) {
-		unsigned char *row = &image[y*stride];
-		for (x = 0; x < w; x++) {
-			int r = 0, g = 0, b = 0, a = row[3], n = 0;
-			if (a == 0) {
-				if (x-1 > 0 && row[-1] != 0) {
-					r += row[-4];
-					g += row[-3];
-					b += row[-2];
-					n++;
-				}
-				if (x+1 < w && row[7] != 0) {
-					r += row[4];
-					g += row[5];
-					b += row[6];
-					n++;
-				}
-				if (y-1 > 0 && row[-stride+3] != 0) {
-					r += row[-stride];
-					g += row[-stride+1];
-					b += row[-stride+2];
-					n++;
-				}
-				if (y+1 < h && row[stride+3] != 0) {
-					r += row[stride];
-					g += row[stride+1];
-					b += row[stride+2];
-					n++;
-				}
-				if (n > 0) {
-					row[0] = (unsigned char)(r/n);
-					row[1] = (unsigned char)(g/n);
-					row[2] = (unsigned char)(b/n);
+	// Merge the overlapping rectangles, so that no pixel is rendered twice.
+	do {
+		merged = 0;
+		for (i = 0; i < n; i++) {
+			for (j = i+1; j < n; j++) {
+				int* a = &d[i*4], *b = &d[j*4];
+				if (a[0] < b[2] && b[0] < a[2] && a[1] < b[3] && b[1] < a[3]) {
+					if (b[0] < a[0]) a[0] = b[0];
+					if (b[1] < a[1]) a[1] = b[1];
+					if (b[2] > a[2]) a[2] = b[2];
+					if (b[3] > a[3]) a[3] = b[3];
+					n--;
+					memcpy(b, &d[n*4], sizeof(int) * 4);
+					j--;
+					merged = 1;
 				}
 			}
-			row += 4;
 		}
-	}
+	} while (merged);
+
+	// The stale pixels in the rectangles all have to be cleared.
+	if (r->clear == NSVG_CLEAR_BOUNDS)
+		r->clear = NSVG_CLEAR_ALL;
+	for (i = 0; i < n; i++)
+		nsvg__renderDirtyRect(r, image, tx, ty, scale, &d[i*4], dst, w, h, stride);
+	r->clear = clear;
 }
 
+// Grows the buffers of a rasterizer for shapes of up to nedges edges made of up to npoints points,
+// rendered into images up to 'width' pixels wide.
+static int nsvg__reserveBuffers(NSVGrasterizer* r, int nedges, int npoints, int npoints2, int width)
+{
+	int cscanline = r->cscanline;
+
+	r->points = (NSVGpoint*)nsvg__reserveBuffer(r->points, &r->cpoints, npoints, sizeof(NSVGpoint));
+	r->points2 = (NSVGpoint*)nsvg__reserveBuffer(r->points2, &r->cpoints2, npoints2, sizeof(NSVGpoint));
+	r->edges = (NSVGedge*)nsvg__reserveBuffer(r->edges, &r->cedges, nedges, sizeof(NSVGedge));
+	// The sort swaps the edges with edges2, so both have the larger capacity.
+	r->edges2 = (NSVGedge*)nsvg__reserveBuffer(r->edges2, &r->cedges2, r->cedges, sizeof(NSVGedge));
+	r->buckets = (int*)nsvg__reserveBuffer(r->buckets, &r->cbuckets, nedges+1, sizeof(int));
+	if (r->cpoints < npoints || r->cpoints2 < npoints2 || r->cedges < nedges || r->cedges2 < r->cedges || r->cbuckets < nedges+1)
+		return 0;
+	if (!nsvg__reserveActive(r, nedges))
+		return 0;
+
+	r->scanline = (unsigned char*)nsvg__reserveBuffer(r->scanline, &r->cscanline, width, 1);
+	if (r->cscanline < width)
+		return 0;
+	if (r->cscanline > cscanline)
+		memset(r->scanline, 0, r->cscanline);
+
+	if (r->coverage == NSVG_COVERAGE_CELLS) {
+		// A row has at most one cell per pixel, and a sub-scanline adds up to three cells per span.
+		int ccells = r->ccells;
+		r->cells = (NSVGcell*)nsvg__reserveBuffer(r->cells, &r->ccells, width + 2*nedges, sizeof(NSVGcell));
+		r->mcells = (NSVGcell*)nsvg__reserveBuffer(r->mcells, &ccells, width + 2*nedges, sizeof(NSVGcell));
+		if (r->ccells < width + 2*nedges || ccells < width + 2*nedges) {
+			r->ccells = 0;
+			return 0;
+		}
+	} else if (r->coverage == NSVG_COVERAGE_ANALYTIC) {
+		int caccum = r->caccum;
+		r->accum = (int*)nsvg__reserveBuffer(r->accum, &r->caccum, width+2, sizeof(int));
+		r->aedges = (int*)nsvg__reserveBuffer(r->aedges, &r->caedges, nedges, sizeof(int));
+		if (r->caccum < width+2 || r->caedges < nedges)
+			return 0;
+		if (r->caccum > caccum)
+			memset(r->accum, 0, sizeof(int) * r->caccum);
+	}
+	return 1;
+}
 
-static void nsvg__initPaint(NSVGcachedPaint* cache, NSVGpaint* paint, float opacity)
+int nsvgRasterizerReserve(NSVGrasterizer* r, const NSVGimage* image, float scale, int width)
 {
-	int i, j;
-	NSVGgradient* grad;
+	const NSVGshape* shape;
+	int i, nedges = 0, gradients = 0, nshapes = 0, npoly = 0, ntiles;
 
-	cache->type = paint->type;
+	// Without a target every path is flattened, which is the most any render at this scale does.
+	for (shape = image->shapes; shape != NULL; shape = shape->next) {
+		nshapes++;
+		if (shape->paths != NULL && (shape->paths->npts + 2) / 3 > npoly)
+			npoly = (shape->paths->npts + 2) / 3;
+		if (!(shape->flags & NSVG_FLAGS_VISIBLE))
+			continue;
+		if (shape->fill.type != NSVG_PAINT_NONE) {
+			r->nedges = 0;
+			nsvg__flattenShape(r, shape, 0, 0, scale);
+			if (r->nedges > nedges) nedges = r->nedges;
+			if (shape->fill.type != NSVG_PAINT_COLOR) gradients = 1;
+		}
+		if (shape->stroke.type != NSVG_PAINT_NONE && (shape->strokeWidth * scale) > 0.01f) {
+			r->nedges = 0;
+			nsvg__flattenShapeStroke(r, shape, 0, 0, scale);
+			if (r->nedges > nedges) nedges = r->nedges;
+			if (shape->stroke.type != NSVG_PAINT_COLOR) gradients = 1;
+		}
+	}
+	r->nedges = 0;
+	r->npoints = 0;
+	r->npoints2 = 0;
 
-	if (paint->type == NSVG_PAINT_COLOR) {
-		cache->colors[0] = nsvg__applyOpacity(paint->color, opacity);
-		return;
+	if (gradients && r->gradients == NULL) {
+		r->gradients = (NSVGcachedGradient*)calloc(NSVG__GRADIENT_CACHE, sizeof(NSVGcachedGradient));
+		if (r->gradients == NULL) return 0;
 	}
 
-	grad = paint->gradient;
+	// The tiles for occlusion culling are sized for the height of the whole image.
+	ntiles = ((width + (1 << NSVG__OCCLUSION_SHIFT) - 1) >> NSVG__OCCLUSION_SHIFT) *
+			 (((int)ceilf(image->height * scale) + (1 << NSVG__OCCLUSION_SHIFT) - 1) >> NSVG__OCCLUSION_SHIFT);
+
+	if (!nsvg__reserveBuffers(r, nedges, r->cpoints, r->cpoints2, width))
+		return 0;
+	if (r->occlusion && !nsvg__reserveOcclusion(r, nshapes, npoly, ntiles))
+		return 0;
+	// Threads of nsvgRasterizeParallel() render bands of the same width.
+	for (i = 0; i < r->nworkers; i++) {
+		if (!nsvg__reserveBuffers(r->workers[i], nedges, r->cpoints, r->cpoints2, width))
+			return 0;
+		if (r->occlusion && !nsvg__reserveOcclusion(r->workers[i], nshapes, npoly, ntiles))
+			return 0;
+	}
+	return 1;
+}
 
-	cache->spread = grad->spread;
-	memcpy(cache->xform, grad->xform, sizeof(float)*6);
+void nsvgRasterizerTrim(NSVGrasterizer* r, int maxBytes)
+{
+	NSVGactiveEdges* a = &r->active;
+	int i, cap;
+
+	for (i = 0; i < r->nworkers; i++)
+		nsvgRasterizerTrim(r->workers[i], maxBytes);
+
+	r->points = (NSVGpoint*)nsvg__trimBuffer(r->points, &r->cpoints, sizeof(NSVGpoint), maxBytes);
+	r->points2 = (NSVGpoint*)nsvg__trimBuffer(r->points2, &r->cpoints2, sizeof(NSVGpoint), maxBytes);
+	r->edges = (NSVGedge*)nsvg__trimBuffer(r->edges, &r->cedges, sizeof(NSVGedge), maxBytes);
+	r->edges2 = (NSVGedge*)nsvg__trimBuffer(r->edges2, &r->cedges2, sizeof(NSVGedge), maxBytes);
+	r->buckets = (int*)nsvg__trimBuffer(r->buckets, &r->cbuckets, sizeof(int), maxBytes);
+	r->scanline = (unsigned char*)nsvg__trimBuffer(r->scanline, &r->cscanline, 1, maxBytes);
+	r->accum = (int*)nsvg__trimBuffer(r->accum, &r->caccum, sizeof(int), maxBytes);
+	r->aedges = (int*)nsvg__trimBuffer(r->aedges, &r->caedges, sizeof(int), maxBytes);
+	r->dirty = (int*)nsvg__trimBuffer(r->dirty, &r->cdirty, sizeof(int) * 4, maxBytes);
+	r->scratch = (unsigned char*)nsvg__trimBuffer(r->scratch, &r->cscratch, 1, maxBytes);
+	r->tiles = (unsigned char*)nsvg__trimBuffer(r->tiles, &r->ctiles, 1, maxBytes);
+	r->occluder = (float*)nsvg__trimBuffer(r->occluder, &r->coccluder, sizeof(float), maxBytes);
+
+	// The buffers sharing a capacity are freed together.
+	cap = r->cshapes;
+	r->culled = (unsigned char*)nsvg__trimBuffer(r->culled, &cap, sizeof(NSVGshape*), maxBytes);
+	r->shapes = (const NSVGshape**)nsvg__trimBuffer(r->shapes, &r->cshapes, sizeof(NSVGshape*), maxBytes);
+	cap = r->ccells;
+	r->cells = (NSVGcell*)nsvg__trimBuffer(r->cells, &cap, sizeof(NSVGcell), maxBytes);
+	r->mcells = (NSVGcell*)nsvg__trimBuffer(r->mcells, &r->ccells, sizeof(NSVGcell), maxBytes);
+	cap = a->cedges;
+	a->x = (int*)nsvg__trimBuffer(a->x, &cap, sizeof(int), maxBytes);
+	cap = a->cedges;
+	a->dx = (int*)nsvg__trimBuffer(a->dx, &cap, sizeof(int), maxBytes);
+	cap = a->cedges;
+	a->ey = (float*)nsvg__trimBuffer(a->ey, &cap, sizeof(float), maxBytes);
+	cap = a->cedges;
+	a->dir = (int*)nsvg__trimBuffer(a->dir, &cap, sizeof(int), maxBytes);
+	cap = a->cedges;
+	a->ex = (float*)nsvg__trimBuffer(a->ex, &cap, sizeof(float), maxBytes);
+	cap = a->cedges;
+	a->ey0 = (float*)nsvg__trimBuffer(a->ey0, &cap, sizeof(float), maxBytes);
+	a->dxdy = (float*)nsvg__trimBuffer(a->dxdy, &a->cedges, sizeof(float), maxBytes);
+
+	cap = NSVG__GRADIENT_CACHE;
+	r->gradients = (NSVGcachedGradient*)nsvg__trimBuffer(r->gradients, &cap, sizeof(NSVGcachedGradient), maxBytes);
+}
 
-	if (grad->nstops == 0) {
-		for (i = 0; i < 256; i++)
-			cache->colors[i] = 0;
-	} else if (grad->nstops == 1) {
-		unsigned int color = nsvg__applyOpacity(grad->stops[0].color, opacity);
-		for (i = 0; i < 256; i++)
-			cache->colors[i] = color;
-	} else {
-		unsigned int ca, cb = 0;
-		float ua, ub, du, u;
-		int ia, ib, count;
+#define NSVG__MAX_THREADS		64
+#define NSVG__BANDS_PER_THREAD	4
+#define NSVG__MIN_BAND_HEIGHT	16
+
+typedef struct NSVGrasterJob {
+	NSVGrasterizer* r;
+	const NSVGimage* image;
+	float tx, ty, scale;
+	unsigned char* dst;
+	int w, h, stride;
+	int first, step;		// Bands first, first+step, first+2*step... belong to this job.
+	int bandHeight;
+	int rect[4];			// Area drawn to, see nsvg__drawnRect().
+} NSVGrasterJob;
+
+static void nsvg__renderBands(NSVGrasterJob* job)
+{
+	NSVGrasterizer* r = job->r;
+	int* rect = job->rect;
+	// The drawn area is unpremultiplied as an image of its own, ry0..ry1 are the rows of the band in it.
+	unsigned char* area = &job->dst[rect[1]*job->stride + rect[0]*4];
+	int y0, y1, ry0, ry1;
+
+	for (y0 = job->first * job->bandHeight; y0 < job->h; y0 += job->step * job->bandHeight) {
+		y1 = y0 + job->bandHeight;
+		if (y1 > job->h) y1 = job->h;
+		ry0 = (y0 > rect[1] ? y0 : rect[1]) - rect[1];
+		ry1 = (y1 < rect[3] ? y1 : rect[3]) - rect[1];
+
+		if (!nsvg__setTarget(r, &job->dst[y0*job->stride], job->w, y1-y0, job->stride, 0, y0))
+			break;
+		if (r->clear != NSVG_CLEAR_NONE)
+			nsvg__clearRect(r, job->dst, job->stride, rect[0], rect[1] + ry0, rect[2], rect[1] + ry1);
+		nsvg__rasterizeShapes(r, job->image, NULL, job->tx, job->ty, job->scale);
+		if (nsvg__needsUnpremultiply(r))
+			nsvg__unpremultiplyRows(area, rect[2]-rect[0], rect[3]-rect[1], ry0, ry1, job->stride, r->unpremul);
+	}
 
-		ca = nsvg__applyOpacity(grad->stops[0].color, opacity);
-		ua = nsvg__clampf(grad->stops[0].offset, 0, 1);
-		ub = nsvg__clampf(grad->stops[grad->nstops-1].offset, ua, 1);
-		ia = (int)(ua * 255.0f);
-		ib = (int)(ub * 255.0f);
-		for (i = 0; i < ia; i++) {
-			cache->colors[i] = ca;
-		}
-
-		for (i = 0; i < grad->nstops-1; i++) {
-			ca = nsvg__applyOpacity(grad->stops[i].color, opacity);
-			cb = nsvg__applyOpacity(grad->stops[i+1].color, opacity);
-			ua = nsvg__clampf(grad->stops[i].offset, 0, 1);
-			ub = nsvg__clampf(grad->stops[i+1].offset, 0, 1);
-			ia = (int)(ua * 255.0f);
-			ib = (int)(ub * 255.0f);
-			count = ib - ia;
-			if (count <= 0) continue;
-			u = 0;
-			du = 1.0f / (float)count;
-			for (j = 0; j < count; j++) {
-				cache->colors[ia+j] = nsvg__lerpRGBA(ca,cb,u);
-				u += du;
-			}
+	nsvg__resetTarget(r);
+}
+
+#ifndef NSVG_NO_THREADS
+#ifdef _WIN32
+static DWORD WINAPI nsvg__bandThread(LPVOID arg)
+{
+	nsvg__renderBands((NSVGrasterJob*)arg);
+	return 0;
+}
+#else
+static void* nsvg__bandThread(void* arg)
+{
+	nsvg__renderBands((NSVGrasterJob*)arg);
+	return NULL;
+}
+#endif
+#endif
+
+static void nsvg__runJobs(NSVGrasterJob* jobs, int njobs)
+{
+	int i;
+#ifndef NSVG_NO_THREADS
+#ifdef _WIN32
+	HANDLE threads[NSVG__MAX_THREADS];
+	for (i = 1; i < njobs; i++)
+		threads[i] = CreateThread(NULL, 0, nsvg__bandThread, &jobs[i], 0, NULL);
+	nsvg__renderBands(&jobs[0]);
+	for (i = 1; i < njobs; i++) {
+		if (threads[i] != NULL) {
+			WaitForSingleObject(threads[i], INFINITE);
+			CloseHandle(threads[i]);
+		} else {
+			// Could not start the thread, render the bands here instead.
+			nsvg__renderBands(&jobs[i]);
+		}
+	}
+#else
+	pthread_t threads[NSVG__MAX_THREADS];
+	int started[NSVG__MAX_THREADS];
+	for (i = 1; i < njobs; i++)
+		started[i] = pthread_create(&threads[i], NULL, nsvg__bandThread, &jobs[i]) == 0;
+	nsvg__renderBands(&jobs[0]);
+	for (i = 1; i < njobs; i++) {
+		if (started[i])
+			pthread_join(threads[i], NULL);
+		else
+			nsvg__renderBands(&jobs[i]); // Could not start the thread, render the bands here instead.
+	}
+#endif
+#else
+	for (i = 0; i < njobs; i++)
+		nsvg__renderBands(&jobs[i]);
+#endif
+}
+
+static int nsvg__allocWorkers(NSVGrasterizer* r, int n)
+{
+	int i;
+
+	if (n > r->nworkers) {
+		NSVGrasterizer** workers = (NSVGrasterizer**)realloc(r->workers, sizeof(NSVGrasterizer*) * n);
+		if (workers == NULL) return 0;
+		r->workers = workers;
+		for (i = r->nworkers; i < n; i++) {
+			r->workers[i] = nsvgCreateRasterizer();
+			if (r->workers[i] == NULL) return 0;
+			r->nworkers++;
 		}
+	}
 
-		for (i = ib; i < 256; i++)
-			cache->colors[i] = cb;
+	// Workers render with the same settings as the owner.
+	for (i = 0; i < n; i++) {
+		r->workers[i]->tessTol = r->tessTol;
+		r->workers[i]->distTol = r->distTol;
+		r->workers[i]->coverage = r->coverage;
+		r->workers[i]->subsamples = r->subsamples;
+		r->workers[i]->flattening = r->flattening;
+		r->workers[i]->premultiplied = r->premultiplied;
+		r->workers[i]->format = r->format;
+		r->workers[i]->clear = r->clear;
+		r->workers[i]->occlusion = r->occlusion;
 	}
 
+	return 1;
 }
 
-/*
-static void dumpEdges(NSVGrasterizer* r, const char* name)
+void nsvgRasterizeParallel(NSVGrasterizer* r,
+						   const NSVGimage* image, float tx, float ty, float scale,
+						   unsigned char* dst, int w, int h, int stride, int nthreads)
 {
-	float xmin = 0, xmax = 0, ymin = 0, ymax = 0;
-	NSVGedge *e = NULL;
-	int i;
-	if (r->nedges == 0) return;
-	FILE* fp = fopen(name, "w");
-	if (fp == NULL) return;
+	NSVGrasterJob jobs[NSVG__MAX_THREADS];
+	unsigned char* area;
+	int i, nbands, bandHeight, rect[4], y0, y1, ry0, ry1;
 
-	xmin = xmax = r->edges[0].x0;
-	ymin = ymax = r->edges[0].y0;
-	for (i = 0; i < r->nedges; i++) {
-		e = &r->edges[i];
-		xmin = nsvg__minf(xmin, e->x0);
-		xmin = nsvg__minf(xmin, e->x1);
-		xmax = nsvg__maxf(xmax, e->x0);
-		xmax = nsvg__maxf(xmax, e->x1);
-		ymin = nsvg__minf(ymin, e->y0);
-		ymin = nsvg__minf(ymin, e->y1);
-		ymax = nsvg__maxf(ymax, e->y0);
-		ymax = nsvg__maxf(ymax, e->y1);
+	if (nthreads > NSVG__MAX_THREADS) nthreads = NSVG__MAX_THREADS;
+
+	// Interleave a few bands per thread to even out the load.
+	nbands = nthreads * NSVG__BANDS_PER_THREAD;
+	bandHeight = (h + nbands-1) / nbands;
+	if (bandHeight < NSVG__MIN_BAND_HEIGHT) bandHeight = NSVG__MIN_BAND_HEIGHT;
+	nbands = (h + bandHeight-1) / bandHeight;
+	if (nthreads > nbands) nthreads = nbands;
+
+	if (nthreads < 2 || !nsvg__allocWorkers(r, nthreads-1)) {
+		nsvgRasterize(r, image, tx, ty, scale, dst, w, h, stride);
+		return;
 	}
 
-	fprintf(fp, "<svg viewBox=\"%f %f %f %f\" xmlns=\"http://www.w3.org/2000/svg\">", xmin, ymin, (xmax - xmin), (ymax - ymin));
+	nsvg__drawnRect(r, image, tx, ty, scale, 0, 0, w, h, rect);
+	for (i = 0; i < nthreads; i++) {
+		jobs[i].r = i == 0 ? r : r->workers[i-1];
+		jobs[i].image = image;
+		jobs[i].tx = tx;
+		jobs[i].ty = ty;
+		jobs[i].scale = scale;
+		jobs[i].dst = dst;
+		jobs[i].w = w;
+		jobs[i].h = h;
+		jobs[i].stride = stride;
+		jobs[i].first = i;
+		jobs[i].step = nthreads;
+		jobs[i].bandHeight = bandHeight;
+		memcpy(jobs[i].rect, rect, sizeof(rect));
+	}
+	nsvg__runJobs(jobs, nthreads);
 
-	for (i = 0; i < r->nedges; i++) {
-		e = &r->edges[i];
-		fprintf(fp ,"<line x1=\"%f\" y1=\"%f\" x2=\"%f\" y2=\"%f\" style=\"stroke:#000;\" />", e->x0,e->y0, e->x1,e->y1);
+	// Defringing the edge rows of a band reads the rows of its neighbours, and the rows on either side
+	// of a boundary read each other, so they are done here once all bands are unpremultiplied.
+	if (!nsvg__needsUnpremultiply(r))
+		return;
+	area = &dst[rect[1]*stride + rect[0]*4];
+	for (y0 = 0; y0 < h; y0 += bandHeight) {
+		y1 = y0 + bandHeight < h ? y0 + bandHeight : h;
+		ry0 = (y0 > rect[1] ? y0 : rect[1]) - rect[1];
+		ry1 = (y1 < rect[3] ? y1 : rect[3]) - rect[1];
+		nsvg__defringeEdgeRows(area, rect[2]-rect[0], rect[3]-rect[1], ry0, ry1, stride);
 	}
+}
 
-	for (i = 0; i < r->npoints; i++) {
-		if (i+1 < r->npoints)
-			fprintf(fp ,"<line x1=\"%f\" y1=\"%f\" x2=\"%f\" y2=\"%f\" style=\"stroke:#f00;\" />", r->points[i].x, r->points[i].y, r->points[i+1].x, r->points[i+1].y);
-		fprintf(fp ,"<circle cx=\"%f\" cy=\"%f\" r=\"1\" style=\"fill:%s;\" />", r->points[i].x, r->points[i].y, r->points[i].flags == 0 ? "#f00" : "#0f0");
+// A slot holds a rasterizer of the pool, and is claimed by setting 'busy' with a compare and swap.
+#if !defined(NSVG_NO_THREADS) && defined(_WIN32)
+typedef LONG NSVGpoolFlag;
+#else
+typedef int NSVGpoolFlag;
+#endif
+
+typedef struct NSVGpoolSlot {
+	NSVGrasterizer* r;
+	volatile NSVGpoolFlag busy;
+} NSVGpoolSlot;
+
+struct NSVGrasterizerPool
+{
+	NSVGpoolSlot* slots;
+	int nslots;
+};
+
+static int nsvg__claimSlot(NSVGpoolSlot* slot)
+{
+#ifdef NSVG_NO_THREADS
+	if (slot->busy) return 0;
+	slot->busy = 1;
+	return 1;
+#elif defined(_WIN32)
+	return InterlockedCompareExchange(&slot->busy, 1, 0) == 0;
+#else
+	NSVGpoolFlag expected = 0;
+	return __atomic_compare_exchange_n(&slot->busy, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+#endif
+}
+
+static void nsvg__freeSlot(NSVGpoolSlot* slot)
+{
+#ifdef NSVG_NO_THREADS
+	slot->busy = 0;
+#elif defined(_WIN32)
+	InterlockedExchange(&slot->busy, 0);
+#else
+	__atomic_store_n(&slot->busy, 0, __ATOMIC_RELEASE);
+#endif
+}
+
+NSVGrasterizerPool* nsvgCreateRasterizerPool(int size)
+{
+	NSVGrasterizerPool* pool = (NSVGrasterizerPool*)malloc(sizeof(NSVGrasterizerPool));
+	if (pool == NULL) goto error;
+	memset(pool, 0, sizeof(NSVGrasterizerPool));
+
+	if (size < 1) size = 1;
+	pool->slots = (NSVGpoolSlot*)calloc(size, sizeof(NSVGpoolSlot));
+	if (pool->slots == NULL) goto error;
+	pool->nslots = size;
+
+	return pool;
+
+error:
+	nsvgDeleteRasterizerPool(pool);
+	return NULL;
+}
+
+NSVGrasterizer* nsvgAcquireRasterizer(NSVGrasterizerPool* pool)
+{
+	int i;
+
+	for (i = 0; i < pool->nslots; i++) {
+		NSVGpoolSlot* slot = &pool->slots[i];
+		if (!nsvg__claimSlot(slot))
+			continue;
+		// The slot is ours until it is freed, so the rasterizer can be created without a lock.
+		if (slot->r == NULL) {
+			slot->r = nsvgCreateRasterizer();
+			if (slot->r == NULL) {
+				nsvg__freeSlot(slot);
+				return NULL;
+			}
+			slot->r->slot = i+1;
+		}
+		return slot->r;
 	}
 
-	fprintf(fp, "</svg>");
-	fclose(fp);
+	// All taken, hand out a context of its own.
+	return nsvgCreateRasterizer();
 }
-*/
 
-void nsvgRasterize(NSVGrasterizer* r,
-				   NSVGimage* image, float tx, float ty, float scale,
-				   unsigned char* dst, int w, int h, int stride)
+void nsvgReleaseRasterizer(NSVGrasterizerPool* pool, NSVGrasterizer* r)
+{
+	if (r == NULL) return;
+	if (r->slot > 0 && r->slot <= pool->nslots && pool->slots[r->slot-1].r == r)
+		nsvg__freeSlot(&pool->slots[r->slot-1]);
+	else
+		nsvgDeleteRasterizer(r);
+}
+
+void nsvgDeleteRasterizerPool(NSVGrasterizerPool* pool)
 {
-	NSVGshape *shape = NULL;
-	NSVGedge *e = NULL;
-	NSVGcachedPaint cache;
 	int i;
-    int j;
-    unsigned char paintOrder;
 
-	r->bitmap = dst;
-	r->width = w;
-	r->height = h;
-	r->stride = stride;
+	if (pool == NULL) return;
 
-	if (w > r->cscanline) {
-		r->cscanline = w;
-		r->scanline = (unsigned char*)realloc(r->scanline, w);
-		if (r->scanline == NULL) return;
+	if (pool->slots != NULL) {
+		for (i = 0; i < pool->nslots; i++)
+			nsvgDeleteRasterizer(pool->slots[i].r);
+		free(pool->slots);
 	}
 
-	for (i = 0; i < h; i++)
-		memset(&dst[i*stride], 0, w*4);
+	free(pool);
+}
 
-	for (shape = image->shapes; shape != NULL; shape = shape->next) {
-		if (!(shape->flags & NSVG_FLAGS_VISIBLE))
-			continue;
+NSVGrasterCache* nsvgCreateRasterCache(void)
+{
+	NSVGrasterCache* cache = (NSVGrasterCache*)malloc(sizeof(NSVGrasterCache));
+	if (cache == NULL) return NULL;
+	memset(cache, 0, sizeof(NSVGrasterCache));
+	return cache;
+}
 
-        for (j = 0; j < 3; j++) {
-            paintOrder = (shape->paintOrder >> (2 * j)) & 0x03;
+void nsvgResetRasterCache(NSVGrasterCache* cache)
+{
+	cache->image = NULL;
+	cache->nedges = 0;
+	cache->nshapes = 0;
+}
 
-            if (paintOrder == NSVG_PAINT_FILL && shape->fill.type != NSVG_PAINT_NONE) {
-                nsvg__resetPool(r);
-                r->freelist = NULL;
-                r->nedges = 0;
+void nsvgDeleteRasterCache(NSVGrasterCache* cache)
+{
+	if (cache == NULL) return;
+	if (cache->edges) free(cache->edges);
+	if (cache->order) free(cache->order);
+	if (cache->shapes) free(cache->shapes);
+	if (cache->sort) free(cache->sort);
+	free(cache);
+}
 
-                nsvg__flattenShape(r, shape, scale);
+static int nsvg__cmpOrderedEdge(const void *p, const void *q)
+{
+	const NSVGorderedEdge* a = (const NSVGorderedEdge*)p;
+	const NSVGorderedEdge* b = (const NSVGorderedEdge*)q;
 
-                // Scale and translate edges
-                for (i = 0; i < r->nedges; i++) {
-                    e = &r->edges[i];
-                    e->x0 = tx + e->x0;
-                    e->y0 = (ty + e->y0) * NSVG__SUBSAMPLES;
-                    e->x1 = tx + e->x1;
-                    e->y1 = (ty + e->y1) * NSVG__SUBSAMPLES;
-                }
+	if (a->top < b->top) return -1;
+	if (a->top > b->top) return  1;
+	return a->order - b->order;
+}
 
-                // Rasterize edges
-                if (r->nedges != 0)
-                    qsort(r->edges, r->nedges, sizeof(NSVGedge), nsvg__cmpEdge);
+// Appends the rasterizer's edges to the cache, sorted by top and emission order.
+static int nsvg__cacheEdges(NSVGrasterCache* cache, NSVGrasterizer* r, int* start, int* count)
+{
+	int i, n = r->nedges;
+
+	*start = cache->nedges;
+	*count = 0;
+	if (n == 0)
+		return 1;
+
+	if (cache->csort < n) {
+		cache->csort = n;
+		cache->sort = (NSVGorderedEdge*)realloc(cache->sort, sizeof(NSVGorderedEdge) * cache->csort);
+		if (cache->sort == NULL) {
+			cache->csort = 0;
+			return 0;
+		}
+	}
+	if (cache->nedges + n > cache->cedges) {
+		cache->cedges = cache->nedges + n > cache->cedges * 2 ? cache->nedges + n : cache->cedges * 2;
+		cache->edges = (NSVGedge*)realloc(cache->edges, sizeof(NSVGedge) * cache->cedges);
+		cache->order = (int*)realloc(cache->order, sizeof(int) * cache->cedges);
+		if (cache->edges == NULL || cache->order == NULL) {
+			cache->cedges = 0;
+			return 0;
+		}
+	}
 
-                // now, traverse the scanlines and find the intersections on each scanline, use non-zero rule
-                nsvg__initPaint(&cache, &shape->fill, shape->opacity);
+	for (i = 0; i < n; i++) {
+		cache->sort[i].edge = r->edges[i];
+		cache->sort[i].top = nsvg__edgeTop(&r->edges[i]);
+		cache->sort[i].order = i;
+	}
+	qsort(cache->sort, n, sizeof(NSVGorderedEdge), nsvg__cmpOrderedEdge);
+	for (i = 0; i < n; i++) {
+		cache->edges[*start + i] = cache->sort[i].edge;
+		cache->order[*start + i] = cache->sort[i].order;
+	}
 
-                nsvg__rasterizeSortedEdges(r, tx,ty,scale, &cache, shape->fillRule);
-            }
-            if (paintOrder == NSVG_PAINT_STROKE && shape->stroke.type != NSVG_PAINT_NONE && (shape->strokeWidth * scale) > 0.01f) {
-                nsvg__resetPool(r);
-                r->freelist = NULL;
-                r->nedges = 0;
-
-                nsvg__flattenShapeStroke(r, shape, scale);
-
-    //			dumpEdges(r, "edge.svg");
-
-                // Scale and translate edges
-                for (i = 0; i < r->nedges; i++) {
-                    e = &r->edges[i];
-                    e->x0 = tx + e->x0;
-                    e->y0 = (ty + e->y0) * NSVG__SUBSAMPLES;
-                    e->x1 = tx + e->x1;
-                    e->y1 = (ty + e->y1) * NSVG__SUBSAMPLES;
-                }
+	cache->nedges += n;
+	*count = n;
+	return 1;
+}
 
-                // Rasterize edges
-                if (r->nedges != 0)
-                    qsort(r->edges, r->nedges, sizeof(NSVGedge), nsvg__cmpEdge);
+// Flattens all fills and strokes of the image at the scale, without culling against a destination.
+static int nsvg__fillRasterCache(NSVGrasterizer* r, NSVGrasterCache* cache, const NSVGimage* image, float scale)
+{
+	const NSVGshape* shape;
+	int n = 0;
 
-                // now, traverse the scanlines and find the intersections on each scanline, use non-zero rule
-                nsvg__initPaint(&cache, &shape->stroke, shape->opacity);
+	nsvgResetRasterCache(cache);
 
-                nsvg__rasterizeSortedEdges(r, tx,ty,scale, &cache, NSVG_FILLRULE_NONZERO);
-            }
-        }
+	for (shape = image->shapes; shape != NULL; shape = shape->next) {
+		NSVGcachedShape* cs;
+		if (n+1 > cache->cshapes) {
+			cache->cshapes = cache->cshapes > 0 ? cache->cshapes * 2 : 64;
+			cache->shapes = (NSVGcachedShape*)realloc(cache->shapes, sizeof(NSVGcachedShape) * cache->cshapes);
+			if (cache->shapes == NULL) {
+				cache->cshapes = 0;
+				return 0;
+			}
+		}
+		cs = &cache->shapes[n++];
+		memset(cs, 0, sizeof(NSVGcachedShape));
+		if (!(shape->flags & NSVG_FLAGS_VISIBLE))
+			continue;
+
+		if (shape->fill.type != NSVG_PAINT_NONE) {
+			r->nedges = 0;
+			nsvg__flattenShape(r, shape, 0, 0, scale);
+			if (!nsvg__cacheEdges(cache, r, &cs->fill, &cs->nfill))
+				return 0;
+		}
+		if (shape->stroke.type != NSVG_PAINT_NONE && (shape->strokeWidth * scale) > 0.01f) {
+			r->nedges = 0;
+			nsvg__flattenShapeStroke(r, shape, 0, 0, scale);
+			if (!nsvg__cacheEdges(cache, r, &cs->stroke, &cs->nstroke))
+				return 0;
+		}
 	}
 
-	nsvg__unpremultiplyAlpha(dst, w, h, stride);
+	cache->nshapes = n;
+	cache->image = image;
+	cache->scale = scale;
+	cache->tessTol = r->tessTol;
+	cache->distTol = r->distTol;
+	cache->flattening = r->flattening;
+	return 1;
+}
 
-	r->bitmap = NULL;
-	r->width = 0;
-	r->height = 0;
-	r->stride = 0;
+void nsvgRasterizeCached(NSVGrasterizer* r, NSVGrasterCache* cache,
+						 const NSVGimage* image, float tx, float ty, float scale,
+						 unsigned char* dst, int w, int h, int stride)
+{
+	int rect[4];
+
+	if (cache->image != image || cache->scale != scale || cache->tessTol != r->tessTol ||
+		cache->distTol != r->distTol || cache->flattening != r->flattening) {
+		if (!nsvg__fillRasterCache(r, cache, image, scale)) {
+			// Could not cache the geometry, render without it.
+			nsvgResetRasterCache(cache);
+			nsvgRasterize(r, image, tx, ty, scale, dst, w, h, stride);
+			return;
+		}
+	}
+
+	if (!nsvg__setTarget(r, dst, w, h, stride, 0, 0))
+		return;
+
+	nsvg__beginTarget(r, image, tx, ty, scale, rect);
+
+	nsvg__rasterizeShapes(r, image, cache, tx, ty, scale);
+
+	nsvg__endTarget(r, rect);
 }
 
 #endif // NANOSVGRAST_IMPLEMENTATION
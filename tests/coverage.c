@@ -0,0 +1,110 @@
+// Compares the coverage of long, nearly vertical edges at 16 sub-scanlines with the exact area of the
+// polygon in each pixel. Stepping the edges used to add up rounding errors until they were whole
+// pixels off.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "nanosvg.h"
+#include "nanosvgrast.h"
+
+// Each sub-scanline truncates the coverage of the pixels an edge crosses by up to one level.
+#define MAX_ERROR	16
+
+typedef struct Polygon {
+	const char* svg;
+	float pts[8][2];
+	int npts;
+	float scale;
+} Polygon;
+
+static const Polygon polygons[] = {
+	{ "<svg xmlns='http://www.w3.org/2000/svg' width='200' height='1010'><path d='M0 0 L200 0 L0 1000 Z'/></svg>",
+	  { {0,0}, {200,0}, {0,1000} }, 3, 1.3f },
+	{ "<svg xmlns='http://www.w3.org/2000/svg' width='120' height='700'><path d='M10 5 L40 5 L110 690 L80 690 Z'/></svg>",
+	  { {10,5}, {40,5}, {110,690}, {80,690} }, 4, 0.9f },
+};
+
+// Area of the polygon inside the pixel x,y, by clipping it to each side of the pixel in turn.
+static double pixelArea(const float (*pts)[2], int npts, float scale, int x, int y)
+{
+	double a[32][2], b[32][2], area = 0.0;
+	int i, j, side, n = npts, m;
+
+	for (i = 0; i < n; i++) {
+		a[i][0] = pts[i][0] * scale;
+		a[i][1] = pts[i][1] * scale;
+	}
+	for (side = 0; side < 4; side++) {
+		int axis = side & 1;
+		double lim = (side < 2 ? (axis ? y : x) : (axis ? y+1 : x+1));
+		double sign = side < 2 ? 1.0 : -1.0;
+		for (i = 0, m = 0; i < n; i++) {
+			double* p = a[i], *q = a[(i+1) % n];
+			double dp = (p[axis] - lim) * sign, dq = (q[axis] - lim) * sign;
+			if (dp >= 0.0) {
+				b[m][0] = p[0]; b[m][1] = p[1]; m++;
+			}
+			if ((dp >= 0.0) != (dq >= 0.0)) {
+				double t = dp / (dp - dq);
+				b[m][0] = p[0] + (q[0] - p[0]) * t;
+				b[m][1] = p[1] + (q[1] - p[1]) * t;
+				m++;
+			}
+		}
+		memcpy(a, b, sizeof(double) * 2 * m);
+		n = m;
+	}
+	for (i = 0, j = n-1; i < n; j = i++)
+		area += a[j][0] * a[i][1] - a[i][0] * a[j][1];
+	return fabs(area) * 0.5;
+}
+
+int main(void)
+{
+	NSVGrasterizer* rast = nsvgCreateRasterizer();
+	int i, x, y, failed = 0;
+
+	for (i = 0; i < (int)(sizeof(polygons) / sizeof(polygons[0])); i++) {
+		const Polygon* poly = &polygons[i];
+		char* svg = (char*)malloc(strlen(poly->svg) + 1);
+		NSVGimage* image;
+		unsigned char* img;
+		int w, h, maxError = 0, ex = 0, ey = 0;
+
+		strcpy(svg, poly->svg);
+		image = nsvgParse(svg, "px", 96);
+		free(svg);
+		if (image == NULL)
+			return 1;
+		w = (int)(image->width * poly->scale) + 2;
+		h = (int)(image->height * poly->scale) + 2;
+		img = (unsigned char*)malloc(w * h);
+
+		nsvgRasterizerSetSubsamples(rast, 16);
+		nsvgRasterizerSetFormat(rast, NSVG_FORMAT_A8);
+		nsvgRasterize(rast, image, 0, 0, poly->scale, img, w, h, w);
+		for (y = 0; y < h; y++) {
+			for (x = 0; x < w; x++) {
+				int exact = (int)(pixelArea(poly->pts, poly->npts, poly->scale, x, y) * 255.0 + 0.5);
+				int err = abs(img[y*w + x] - exact);
+				if (err > maxError) {
+					maxError = err;
+					ex = x;
+					ey = y;
+				}
+			}
+		}
+		if (maxError > MAX_ERROR) {
+			printf("polygon %d: error %d at %d,%d\n", i, maxError, ex, ey);
+			failed = 1;
+		}
+
+		free(img);
+		nsvgDelete(image);
+	}
+
+	nsvgDeleteRasterizer(rast);
+	return failed;
+}
@@ -0,0 +1,100 @@
+// Renders one shared image from several threads at once, with rasterizers checked out of a pool and
+// with nsvgRasterizeParallel(), and compares the results with serial renders. Built a second time
+// with -fsanitize=thread where the compiler supports it, which then also reports data races.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#define NANOSVG_IMPLEMENTATION
+#include "nanosvg.h"
+#define NANOSVGRAST_IMPLEMENTATION
+#include "nanosvgrast.h"
+
+#define NUM_THREADS	6
+#define NUM_SCALES	3
+#define ITERATIONS	8
+#define SIZE		160
+
+// Transparent gaps between the shapes, so that the straight alpha output is defringed.
+static const char* svgData =
+	"<svg xmlns='http://www.w3.org/2000/svg' width='100' height='100'>"
+	"<defs><linearGradient id='g' x1='0' y1='0' x2='1' y2='1'>"
+	"<stop offset='0' stop-color='#f80'/><stop offset='1' stop-color='#08f' stop-opacity='0.5'/>"
+	"</linearGradient></defs>"
+	"<rect x='5' y='5' width='40' height='30' fill='#3a6'/>"
+	"<circle cx='65' cy='30' r='22' fill='url(#g)'/>"
+	"<path d='M10 90 C30 40 60 120 95 55' fill='none' stroke='#c22' stroke-width='6' stroke-dasharray='9 4'/>"
+	"<ellipse cx='40' cy='70' rx='25' ry='12' fill='#24c' fill-opacity='0.6' transform='rotate(-20 40 70)'/>"
+	"<path d='M70 60 L95 95 L55 92 Z M75 75 L80 88 L68 86 Z' fill='#aa0' fill-rule='evenodd'/>"
+	"</svg>";
+
+static const float scales[NUM_SCALES] = { 0.8f, 1.3f, 1.6f };
+
+static NSVGimage* image;
+static NSVGrasterizerPool* pool;
+static unsigned char* refs[NUM_SCALES];
+static int failed = 0;
+
+static void* renderThread(void* arg)
+{
+	long id = (long)arg;
+	unsigned char* img = (unsigned char*)malloc(SIZE*SIZE*4);
+	int i, k;
+
+	for (i = 0; i < ITERATIONS; i++) {
+		NSVGrasterizer* rast = nsvgAcquireRasterizer(pool);
+		if (rast == NULL)
+			continue;
+		k = (int)(id + i) % NUM_SCALES;
+		nsvgRasterizerSetOcclusion(rast, i & 1);
+		memset(img, 0, SIZE*SIZE*4);
+		if (i % 3 == 0)
+			nsvgRasterizeParallel(rast, image, 0, 0, scales[k], img, SIZE, SIZE, SIZE*4, 3);
+		else
+			nsvgRasterize(rast, image, 0, 0, scales[k], img, SIZE, SIZE, SIZE*4);
+		if (memcmp(img, refs[k], SIZE*SIZE*4) != 0) {
+			printf("thread %ld, iteration %d: the image differs from the serial render\n", id, i);
+			__atomic_store_n(&failed, 1, __ATOMIC_RELAXED);
+		}
+		nsvgReleaseRasterizer(pool, rast);
+	}
+
+	free(img);
+	return NULL;
+}
+
+int main(void)
+{
+	char* svg = (char*)malloc(strlen(svgData) + 1);
+	NSVGrasterizer* rast = nsvgCreateRasterizer();
+	pthread_t threads[NUM_THREADS];
+	long i;
+
+	strcpy(svg, svgData);
+	image = nsvgParse(svg, "px", 96);
+	free(svg);
+	if (image == NULL || rast == NULL)
+		return 1;
+
+	for (i = 0; i < NUM_SCALES; i++) {
+		refs[i] = (unsigned char*)calloc(SIZE*SIZE*4, 1);
+		nsvgRasterize(rast, image, 0, 0, scales[i], refs[i], SIZE, SIZE, SIZE*4);
+	}
+	nsvgDeleteRasterizer(rast);
+
+	// Fewer contexts than threads, so that some threads find the pool empty.
+	pool = nsvgCreateRasterizerPool(NUM_THREADS / 2);
+	for (i = 0; i < NUM_THREADS; i++)
+		pthread_create(&threads[i], NULL, renderThread, (void*)i);
+	for (i = 0; i < NUM_THREADS; i++)
+		pthread_join(threads[i], NULL);
+	nsvgDeleteRasterizerPool(pool);
+
+	for (i = 0; i < NUM_SCALES; i++)
+		free(refs[i]);
+	nsvgDelete(image);
+
+	return failed;
+}